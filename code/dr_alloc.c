@@ -0,0 +1,37 @@
+/* Filename: dr_alloc.c */
+
+#include <stdlib.h>
+
+#include "dr_alloc.h"
+
+static uint64_t allocations;
+
+static void note_allocation() {
+    __atomic_add_fetch(&allocations, 1, __ATOMIC_RELAXED);
+}
+
+void* dr_malloc(size_t size) {
+    note_allocation();
+    return malloc(size);
+}
+
+void* dr_calloc(size_t count, size_t size) {
+    note_allocation();
+    return calloc(count, size);
+}
+
+void* dr_realloc(void* p, size_t size) {
+    note_allocation();
+    return realloc(p, size);
+}
+
+void* dr_aligned_alloc(size_t alignment, size_t size) {
+    void* p;
+
+    note_allocation();
+    return posix_memalign(&p, alignment, size) == 0 ? p : NULL;
+}
+
+uint64_t dr_alloc_count() {
+    return __atomic_load_n(&allocations, __ATOMIC_RELAXED);
+}
@@ -0,0 +1,26 @@
+/*
+ * Filename: dr_alloc.h
+ * Purpose:  Heap allocation for the Dynamic Routing library.  Every allocation
+ *           is counted, so benchmarks can check that the steady state (periodic
+ *           advertisements, repeated advertisements, lookups and timer ticks
+ *           while nothing changes) does not allocate at all.
+ */
+
+#ifndef _DR_ALLOC_H_
+#define _DR_ALLOC_H_
+
+#include <stddef.h>  /* size_t */
+#include <stdint.h>
+
+/** Like malloc, calloc and realloc, but counted; free the memory with free. */
+void* dr_malloc(size_t size);
+void* dr_calloc(size_t count, size_t size);
+void* dr_realloc(void* p, size_t size);
+
+/** Like posix_memalign, but counted and returning NULL on failure. */
+void* dr_aligned_alloc(size_t alignment, size_t size);
+
+/** Returns how many allocations have been made so far (by all threads). */
+uint64_t dr_alloc_count();
+
+#endif /* _DR_ALLOC_H_ */
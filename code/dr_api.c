@@ -4,12 +4,21 @@
 #include <arpa/inet.h>  /* htons, ... */
 #include <sys/socket.h> /* AF_INET */
 
+#include <assert.h>
 #include <pthread.h>
 #include <stdio.h>
 #include <stdlib.h>
-#include <sys/time.h>
+#include <string.h>
 
+#include "dr_alloc.h"
 #include "dr_api.h"
+#include "dr_capture.h"
+#include "dr_clock.h"
+#include "dr_crc.h"
+#include "dr_fib.h"
+#include "dr_hist.h"
+#include "dr_pcap.h"
+#include "dr_stats.h"
 #include "rmutex.h"
 
 /* internal data structures */
@@ -25,6 +34,14 @@
 #define RIP_TIMEOUT_SEC 20
 #define RIP_GARBAGE_SEC 20
 
+/* tracing packets and tables is far too expensive outside of debug builds; it
+   goes to stderr, so whatever the host writes to stdout stays readable */
+#ifdef _DEBUG_
+#define DR_TRACE(...) fprintf(stderr, __VA_ARGS__)
+#else
+#define DR_TRACE(...) do { if (0) fprintf(stderr, __VA_ARGS__); } while (0)
+#endif
+
 /** information about a route which is sent with a RIP packet */
 typedef struct rip_entry_t {
     uint16_t addr_family;
@@ -43,6 +60,51 @@ typedef struct rip_header_t {
     rip_entry_t entries[0];
 } __attribute__ ((packed)) rip_header_t;
 
+struct path_t;
+struct route_t;
+
+/** a router heard on one of our interfaces */
+typedef struct neighbour_t {
+    uint32_t ip;
+    uint32_t intf;
+    long last_heard;        /* when its last advertisement arrived */
+    bool expired;           /* whether its routes were timed out since */
+    uint64_t adverts;       /* how many of its advertisements were merged */
+    unsigned path_count;    /* how many paths it has */
+
+    /* a copy of its last advertisement, as merged into the table at
+       table_version (if remembered); one which repeats it is told by its CRC-32C
+       and then compared in full */
+    bool remembered;
+    uint32_t fingerprint;   /* CRC-32C of the payload */
+    uint64_t fingerprint_version;
+    char *last_buf;
+    unsigned last_len;
+    unsigned last_size;
+    path_t *paths;          /* everything it advertised, linked by nbr_next */
+
+    /* its token bucket (see dr_set_rate_limit), and the last advertisement it
+       sent beyond that, if it waits to be merged */
+    uint64_t tokens;        /* in thousandths of an advertisement */
+    long bucket_time;       /* when tokens were last added */
+    bool deferred;
+    char *deferred_buf;
+    unsigned deferred_len;
+    unsigned deferred_size;
+    neighbour_t *next;
+} neighbour_t;
+
+/** what one neighbour last advertised for a subnet */
+typedef struct path_t {
+    neighbour_t *neighbour;
+    route_t *route;
+    uint32_t metric;        /* as advertised (always below INFINITY) */
+    uint64_t heard;         /* the advertisement of the neighbour it was last in */
+    path_t *next;           /* the next path to the same subnet */
+    path_t *nbr_prev;       /* the paths of the same neighbour */
+    path_t *nbr_next;
+} path_t;
+
 /** a single entry in the routing table */
 typedef struct route_t {
     uint32_t subnet;        /* destination subnet which this route is for */
@@ -50,24 +112,173 @@ typedef struct route_t {
     uint32_t next_hop_ip;   /* next hop on on this route */
     uint32_t outgoing_intf; /* interface to use to send packets on this route */
     uint32_t cost;
-    long last_updated;   //CHANGED MYSELF
+    neighbour_t *via;       /* who it was learned from (NULL if directly connected);
+                               the route lives as long as it is heard */
 
     int is_garbage; /* boolean which notes whether this entry is garbage */
 
+    /* what each neighbour last advertised for this subnet (the Adj-RIB-In);
+       alternates to fail over to and the input of exact recomputations */
+    path_t *paths;
+
+    /* the state of the route as last announced to the route listeners */
+    int announced;          /* boolean; whether listeners know it as usable */
+    next_hop_t announced_hop;
+    uint32_t announced_cost;
+
     route_t *next;  /* pointer to the next route in a linked-list */
     route_t *previous; /*for double linked list */
 
+    /* the routes with the same outgoing interface */
+    route_t *intf_next;
+    route_t *intf_prev;
+    bool intf_subnet;       /* whether subnet_routes may refer to it */
+
 } route_t;
 
 
+/* the entry points and the parts of them which are timed */
+enum { OP_GET_NEXT_HOP, OP_HANDLE_PACKET, OP_HANDLE_PERIODIC, OP_INTERFACE_CHANGED, OP_COUNT };
+enum { PHASE_WAIT, PHASE_SAFE, PHASE_TOTAL, PHASE_COUNT };
+
+static const char *op_names[OP_COUNT] = {
+    "dr_get_next_hop", "dr_handle_packet", "dr_handle_periodic", "dr_interface_changed"
+};
+static const char *phase_names[PHASE_COUNT] = { "wait", "safe", "total" };
+
+/** a slot of the hash table from connected subnets to interfaces */
+typedef struct connected_slot_t {
+    uint32_t subnet;
+    uint32_t mask;
+    int intf;                   /* -1 if the slot is free */
+} connected_slot_t;
+
+/** orders prefixes by address, and those at the same address from short to long */
+static inline uint64_t prefix_key(uint32_t subnet, uint32_t mask) {
+    return (uint64_t) ntohl(subnet) << 32 | ntohl(mask);
+}
+
+/** a function which is told about changes of the usable routes */
+typedef struct route_listener_t {
+    dr_route_listener_t fn;
+    void *user;
+} route_listener_t;
+
+/** the state of one router: its routing table and how to reach its host */
+struct dr_router_t {
+    /* a very coarse recursive mutex to synchronize access to methods */
+    rmutex_t coarse_lock;
+
+    /* the functions the host provides for this router */
+    dr_host_t host;
+
+    /* a snapshot of the host's interfaces, taken when the router is created
+       and whenever an interface changes, and the enabled ones by subnet */
+    lvns_interface_t *intfs;
+    unsigned intf_total;
+    connected_slot_t *connected;
+    unsigned connected_shift;   /* 32 - log2 of the number of slots */
+
+    /* the routes by outgoing interface and the route to the subnet of each
+       interface (if known), for every interface there has been, and the
+       neighbours heard so far */
+    route_t **intf_routes;
+    route_t **subnet_routes;
+    unsigned intf_routes_size;
+    neighbour_t *neighbours;
+
+    route_t *head;          /* the table, sorted by prefix_key */
+    route_t *tail;
+    unsigned int tablelength;
+
+    /* whether sent advertisements merge sibling prefixes, and the prefix_keys
+       of the merged prefixes sent last time (sorted) and their CRC-32C; those
+       are ours, so they are not learned back from the neighbours */
+    bool aggregate;
+    uint64_t *summaries;
+    unsigned summary_count;
+    unsigned summaries_size;
+    uint32_t summaries_crc;
+
+    /* the valid entries of the advertisement being merged, sorted by prefix_key */
+    rip_entry_t **sorted_entries;
+    unsigned sorted_entries_size;
+
+    /* the advertisement being sent, and the usable routes being loaded into the
+       FIB; kept from one call to the next, so that neither allocates unless
+       the table grew */
+    rip_entry_t *payload;
+    unsigned payload_size;
+    fib_entry_t *fib_entries;
+    unsigned fib_entries_size;
+    long lastsent;
+
+    /* forwarding table answering dr_get_next_hop; rebuilt once dirty by the
+       call which changed the table, so that lookups never wait for that */
+    fib_t *fib;
+    bool fib_dirty;
+    bool compress_fib;      /* load it with fib_compress'ed routes */
+
+    /* how many routes the neighbours may make us learn; when the table is full,
+       make_room sweeps it for unreachable routes at most once per
+       table_version, and at no_victim_version no learned prefix was longer
+       than no_victim_len */
+    dr_route_limits_t limits;
+    uint64_t reclaimed_version;
+    uint64_t no_victim_version;
+    unsigned no_victim_len;
+
+    /* how fast each neighbour may advertise */
+    dr_rate_limit_t rate_limit;
+
+    /* who gets told about changes of the usable routes, and whether the table
+       changed since they were last told */
+    route_listener_t *listeners;
+    unsigned listener_count;
+    bool routes_changed;
+
+    /* counts the changes of the table, so that an advertisement can be seen to
+       have been merged into the table as it is now */
+    uint64_t table_version;
+
+    /* counters for dr_get_stats; all but the lookups are kept under coarse_lock */
+    dr_lookup_counters_t lookups;
+    dr_intf_stats_t intf_stats[DR_STATS_MAX_INTF];
+    uint64_t routes_evicted;
+    uint64_t routes_reclaimed;
+
+    /* the shared-memory page the stats are exported to, if any */
+    dr_stats_page_t *stats_page;
+
+    /* the capture file the calls are recorded in, if any */
+    dr_capture_t *capture;
+
+    /* the pcap file the RIP traffic is exported to, if any */
+    dr_pcap_t *pcap;
+
+    /* whether the entry points are timed (see dr_set_timing; read without the
+       lock), and how long each waited for coarse_lock, spent in its safe_
+       function and took altogether (see dr_dump_timing) */
+    bool timed;
+    dr_hist_t timing[OP_COUNT][PHASE_COUNT];
+};
+
+
 /* internal variables */
 
-/* a very coarse recursive mutex to synchronize access to methods */
-static rmutex_t coarse_lock;
+/** how long to sleep between periodic callbacks */
+static unsigned secs_to_sleep_between_callbacks = 1;
+static unsigned nanosecs_to_sleep_between_callbacks = 0;
+
+/* the routers which get their periodic callbacks from the shared thread */
+static pthread_mutex_t periodic_lock = PTHREAD_MUTEX_INITIALIZER;
+static dr_router_t **periodic_routers;
+static unsigned periodic_count;
+static unsigned periodic_capacity;
+static bool periodic_thread_started;
 
-/** how mlong to sleep between periodic callbacks */
-static unsigned secs_to_sleep_between_callbacks;
-static unsigned nanosecs_to_sleep_between_callbacks;
+/* the router behind the dr_init / dr_get_next_hop / ... entry points */
+static dr_router_t *default_router;
 
 
 /* these static functions are defined by the dr */
@@ -90,50 +301,124 @@ static void (*dr_send_payload)(uint32_t dst_ip,
                                char *buf /* borrowed */,
                                unsigned len);
 
-/*own declarations*/
+/* adapters from the per-router host interface to the functions above */
+static unsigned legacy_interface_count(void *user) {
+    return dr_interface_count();
+}
+
+static lvns_interface_t legacy_get_interface(void *user, unsigned index) {
+    return dr_get_interface(index);
+}
+
+static void legacy_send_payload(void *user, uint32_t dst_ip, uint32_t next_hop_ip,
+                                uint32_t outgoing_intf, char *buf, unsigned len) {
+    dr_send_payload(dst_ip, next_hop_ip, outgoing_intf, buf, len);
+}
+
+/* calls into the host of a router (interfaces are read from the snapshot) */
+static unsigned intf_count(dr_router_t *router) {
+    return router->intf_total;
+}
 
-route_t *head;
-route_t *tail;
-unsigned int tablelength;
-long lastsent;
+static lvns_interface_t get_intf(dr_router_t *router, unsigned index) {
+    static const lvns_interface_t none = lvns_interface_t();
+    return index < router->intf_total ? router->intfs[index] : none;
+}
+
+static void send_payload(dr_router_t *router, uint32_t dst_ip, uint32_t next_hop_ip,
+                         uint32_t outgoing_intf, char *buf, unsigned len) {
+    if (router->pcap != NULL)
+        dr_pcap_write(router->pcap, get_intf(router, outgoing_intf).ip, dst_ip, buf, len);
+    router->host.send_payload(router->host.user, dst_ip, next_hop_ip, outgoing_intf, buf, len);
+}
 
 //Own functions
-static void makeroute_t(route_t *node, uint32_t ip, uint32_t subnet_mask, int cost, int interfnr, uint32_t next_hop_ip);
+static void makeroute_t(route_t *node, uint32_t ip, uint32_t subnet_mask, int cost, int interfnr, neighbour_t *via);
 
 //static void clearup_table();
 //static void addFirst(route_t* node);
-static void addLast(route_t *node);
+static void insert_before(dr_router_t *router, route_t *node, route_t *before);
+static void insert_sorted(dr_router_t *router, route_t *node);
 
 //static void getNode(route_t* node, int index);
 //static void removeNode(route_t* node);
 //static void removeFirst();
 //static void removeLast();
 //static void clear();
-static void send_table();
+static void send_table(dr_router_t *router, bool triggered);
+static unsigned aggregate_entries(dr_router_t *router, rip_entry_t *entries, unsigned count);
+static int cmp_key(const void *a, const void *b);
+static void unique_summaries(dr_router_t *router);
+static int refresh_interfaces(dr_router_t *router);
+static int connected_intf(dr_router_t *router, uint32_t subnet, uint32_t mask);
+static dr_intf_stats_t *intf_stats(dr_router_t *router, unsigned intf);
+static void collect_stats(dr_router_t *router, dr_stats_t *stats);
+static bool timing_enabled(dr_router_t *router);
+static uint64_t timing_ticks(bool timed);
+static void record_timing(dr_router_t *router, int op, uint64_t start, uint64_t locked, uint64_t done);
+static void rebuild_fib(dr_router_t *router);
+static void table_changed(dr_router_t *router);
+static void announce_changes(dr_router_t *router);
+static void capture_config(dr_router_t *router);
+static void notify_listeners(dr_router_t *router, dr_route_event_t event, const route_t *r);
+static void neighbour_quota(dr_router_t *router, rip_entry_t **entries, unsigned count, unsigned quota[33]);
+static bool make_room(dr_router_t *router, uint32_t mask, route_t **current);
+static void remove_route(dr_router_t *router, route_t *route, route_t **current);
+static bool valid_entry(const rip_entry_t *entry);
+static uint64_t entry_key(const rip_entry_t *entry);
+static int sort_entries(dr_router_t *router, rip_entry_t *payload, unsigned count);
+static neighbour_t *find_neighbour(dr_router_t *router, unsigned intf, uint32_t ip);
+static void merge_advert(dr_router_t *router, neighbour_t *neighbour, char *buf, unsigned len, long now);
+static bool take_token(dr_router_t *router, neighbour_t *neighbour, long now);
+static int defer_advert(neighbour_t *neighbour, const char *buf, unsigned len);
+static void remember_advert(dr_router_t *router, neighbour_t *neighbour, const char *buf, unsigned len,
+                            uint32_t fingerprint);
+static void merge_deferred(dr_router_t *router, long now);
+static void record_path(route_t *route, neighbour_t *neighbour, const rip_entry_t *entry);
+static bool withdraw_unheard(dr_router_t *router, neighbour_t *neighbour, long now);
+static bool expire_neighbours(dr_router_t *router, long now);
+static bool expire_route(dr_router_t *router, route_t *route, long now);
+static void unlink_path(path_t *path);
+static void set_next_hop(dr_router_t *router, route_t *route, unsigned intf, neighbour_t *via);
+static void intf_list_add(dr_router_t *router, route_t *route);
+static void intf_list_remove(dr_router_t *router, route_t *route);
+static route_t *find_route(dr_router_t *router, uint32_t subnet, uint32_t mask);
+static route_t *intf_subnet_route(dr_router_t *router, unsigned intf);
+static unsigned path_cost(dr_router_t *router, const path_t *path, long now);
+static bool fail_over(dr_router_t *router, route_t *route, uint32_t feasible, long now);
+static bool select_best(dr_router_t *router, route_t *route, long now);
+
+
+/* verifies the table invariants after every call which may change the table;
+   that takes quadratic time, so only builds which ask for it (dr_fuzz) do */
+#ifdef DR_CHECK_INVARIANTS
+static void check_table(dr_router_t *router);
+#else
+#define check_table(router) do { } while (0)
+#endif
 
 void print_rippacket(uint32_t ip, unsigned intf, rip_entry_t *paket, int nrofentries);
 
 
 /* internal functions */
-long get_time();
-
 void print_ip(int ip);
 
 void print_routing_table(route_t *head);
 
 /* internal lock-safe methods for the students to implement */
-static next_hop_t safe_dr_get_next_hop(uint32_t ip);
+static next_hop_t safe_dr_get_next_hop(dr_router_t *router, uint32_t ip);
 
-static void safe_dr_handle_packet(uint32_t ip, unsigned intf,
+static void safe_dr_handle_packet(dr_router_t *router, uint32_t ip, unsigned intf,
                                   char *buf /* borrowed */, unsigned len);
 
-static void safe_dr_handle_periodic();
+static void safe_dr_handle_periodic(dr_router_t *router);
 
-static void safe_dr_interface_changed(unsigned intf,
+static void safe_dr_interface_changed(dr_router_t *router,
+                                      unsigned intf,
                                       int state_changed,
                                       int cost_changed);
 
-/*** This simple method is the entry point to a thread which will periodically* make a callback to your dr_handle_periodic method.*/
+/*** This simple method is the entry point to a thread which will periodically* make a callback to the dr_handle_periodic method of every router.*/
 static void *periodic_callback_manager_main(void *nil) {
     struct timespec timeout;
 
@@ -141,36 +426,350 @@ static void *periodic_callback_manager_main(void *nil) {
     timeout.tv_nsec = nanosecs_to_sleep_between_callbacks;
     while (1) {
         nanosleep(&timeout, NULL);
-        dr_handle_periodic();
+        pthread_mutex_lock(&periodic_lock);
+        for (unsigned i = 0; i < periodic_count; i++)
+            dr_router_handle_periodic(periodic_routers[i]);
+        pthread_mutex_unlock(&periodic_lock);
     }
 
     return NULL;
 }
 
-next_hop_t dr_get_next_hop(uint32_t ip) {
+/* adds the router to those served by the periodic thread (starting it if needed) */
+static void periodic_register(dr_router_t *router) {
+    pthread_t tid;
+
+    pthread_mutex_lock(&periodic_lock);
+    if (periodic_count == periodic_capacity) {
+        periodic_capacity = periodic_capacity ? 2 * periodic_capacity : 8;
+        periodic_routers = (dr_router_t **) dr_realloc(periodic_routers, periodic_capacity * sizeof(dr_router_t *));
+        if (periodic_routers == NULL)
+            exit(1);
+    }
+    periodic_routers[periodic_count++] = router;
+
+    if (!periodic_thread_started) {
+        if (pthread_create(&tid, NULL, periodic_callback_manager_main, NULL) != 0)
+            exit(1);
+        periodic_thread_started = true;
+    }
+    pthread_mutex_unlock(&periodic_lock);
+}
+
+static void periodic_unregister(dr_router_t *router) {
+    pthread_mutex_lock(&periodic_lock);
+    for (unsigned i = 0; i < periodic_count; i++)
+        if (periodic_routers[i] == router) {
+            periodic_routers[i] = periodic_routers[--periodic_count];
+            break;
+        }
+    pthread_mutex_unlock(&periodic_lock);
+}
+
+next_hop_t dr_router_get_next_hop(dr_router_t *router, uint32_t ip) {
     next_hop_t hop;
-    rmutex_lock(&coarse_lock);
-    hop = safe_dr_get_next_hop(ip);
-    rmutex_unlock(&coarse_lock);
+    bool timed = timing_enabled(router);
+    uint64_t start = timing_ticks(timed);
+    rmutex_lock(&router->coarse_lock);
+    uint64_t locked = timing_ticks(timed);
+    hop = safe_dr_get_next_hop(router, ip);
+    uint64_t done = timing_ticks(timed);
+    rmutex_unlock(&router->coarse_lock);
+    dr_stats_count_lookup(&router->lookups, hop.dst_ip == 0xFFFFFFFF);
+    if (timed)
+        record_timing(router, OP_GET_NEXT_HOP, start, locked, done);
     return hop;
 }
 
+void dr_router_handle_packet(dr_router_t *router, uint32_t ip, unsigned intf,
+                             char *buf /* borrowed */, unsigned len) {
+    bool timed = timing_enabled(router);
+    uint64_t start = timing_ticks(timed);
+    rmutex_lock(&router->coarse_lock);
+    uint64_t locked = timing_ticks(timed);
+    if (router->capture != NULL) {
+        uint32_t head[2] = { ip, intf };
+        dr_capture_write(router->capture, DR_CAPTURE_PACKET, 0, dr_clock_now(), head, sizeof(head),
+                         buf, buf != NULL ? len : 0);
+    }
+    if (router->pcap != NULL)
+        dr_pcap_write(router->pcap, ip, RIP_IP, buf, buf != NULL ? len : 0);
+    safe_dr_handle_packet(router, ip, intf, buf, len);
+    rebuild_fib(router);
+    uint64_t done = timing_ticks(timed);
+    check_table(router);
+    announce_changes(router);
+    rmutex_unlock(&router->coarse_lock);
+    if (timed)
+        record_timing(router, OP_HANDLE_PACKET, start, locked, done);
+}
+
+void dr_router_handle_periodic(dr_router_t *router) {
+    bool timed = timing_enabled(router);
+    uint64_t start = timing_ticks(timed);
+    rmutex_lock(&router->coarse_lock);
+    uint64_t locked = timing_ticks(timed);
+    if (router->capture != NULL)
+        dr_capture_write(router->capture, DR_CAPTURE_PERIODIC, 0, dr_clock_now(), NULL, 0, NULL, 0);
+    safe_dr_handle_periodic(router);
+    rebuild_fib(router);
+    uint64_t done = timing_ticks(timed);
+    check_table(router);
+    announce_changes(router);
+    if (router->stats_page != NULL) {
+        dr_stats_t stats;
+        collect_stats(router, &stats);
+        dr_stats_page_publish(router->stats_page, &stats);
+    }
+    rmutex_unlock(&router->coarse_lock);
+    if (timed)
+        record_timing(router, OP_HANDLE_PERIODIC, start, locked, done);
+}
+
+void dr_router_interface_changed(dr_router_t *router, unsigned intf, int state_changed, int cost_changed) {
+    bool timed = timing_enabled(router);
+    uint64_t start = timing_ticks(timed);
+    rmutex_lock(&router->coarse_lock);
+    uint64_t locked = timing_ticks(timed);
+    refresh_interfaces(router);
+    if (router->capture != NULL) {
+        uint32_t head = intf;
+        unsigned flags = (state_changed ? DR_CAPTURE_STATE_CHANGED : 0) | (cost_changed ? DR_CAPTURE_COST_CHANGED : 0);
+        dr_capture_write_interfaces(router->capture, DR_CAPTURE_INTERFACE_CHANGED, flags, dr_clock_now(),
+                                    &head, sizeof(head), router->intfs, router->intf_total);
+    }
+    safe_dr_interface_changed(router, intf, state_changed, cost_changed);
+    rebuild_fib(router);
+    uint64_t done = timing_ticks(timed);
+    check_table(router);
+    announce_changes(router);
+    rmutex_unlock(&router->coarse_lock);
+    if (timed)
+        record_timing(router, OP_INTERFACE_CHANGED, start, locked, done);
+}
+
+next_hop_t dr_get_next_hop(uint32_t ip) {
+    return dr_router_get_next_hop(default_router, ip);
+}
+
 void dr_handle_packet(uint32_t ip, unsigned intf, char *buf /* borrowed */, unsigned len) {
-    rmutex_lock(&coarse_lock);
-    safe_dr_handle_packet(ip, intf, buf, len);
-    rmutex_unlock(&coarse_lock);
+    dr_router_handle_packet(default_router, ip, intf, buf, len);
 }
 
 void dr_handle_periodic() {
-    rmutex_lock(&coarse_lock);
-    safe_dr_handle_periodic();
-    rmutex_unlock(&coarse_lock);
+    dr_router_handle_periodic(default_router);
 }
 
 void dr_interface_changed(unsigned intf, int state_changed, int cost_changed) {
-    rmutex_lock(&coarse_lock);
-    safe_dr_interface_changed(intf, state_changed, cost_changed);
-    rmutex_unlock(&coarse_lock);
+    dr_router_interface_changed(default_router, intf, state_changed, cost_changed);
+}
+
+void dr_router_get_stats(dr_router_t *router, dr_stats_t *stats) {
+    rmutex_lock(&router->coarse_lock);
+    collect_stats(router, stats);
+    rmutex_unlock(&router->coarse_lock);
+}
+
+int dr_router_export_stats(dr_router_t *router, const char *shm_name) {
+    dr_stats_page_t *page = dr_stats_page_open(shm_name);
+    if (page == NULL)
+        return -1;
+
+    rmutex_lock(&router->coarse_lock);
+    dr_stats_page_close(router->stats_page);
+    router->stats_page = page;
+    rmutex_unlock(&router->coarse_lock);
+    return 0;
+}
+
+void dr_router_dump_timing(dr_router_t *router, FILE *out) {
+    double ticks_per_ns = dr_hist_ticks_per_ns();
+
+    for (int op = 0; op < OP_COUNT; op++)
+        for (int phase = 0; phase < PHASE_COUNT; phase++) {
+            const dr_hist_t *h = &router->timing[op][phase];
+            fprintf(out, "{\"entry_point\":\"%s\",\"phase\":\"%s\",\"count\":%lu,"
+                         "\"p50_ns\":%.0f,\"p90_ns\":%.0f,\"p99_ns\":%.0f,\"p999_ns\":%.0f,\"max_ns\":%.0f}\n",
+                    op_names[op], phase_names[phase], (unsigned long) h->count,
+                    dr_hist_percentile(h, 0.5) / ticks_per_ns,
+                    dr_hist_percentile(h, 0.9) / ticks_per_ns,
+                    dr_hist_percentile(h, 0.99) / ticks_per_ns,
+                    dr_hist_percentile(h, 0.999) / ticks_per_ns,
+                    h->max / ticks_per_ns);
+        }
+    fflush(out);
+}
+
+void dr_dump_timing(FILE *out) {
+    dr_router_dump_timing(default_router, out);
+}
+
+void dr_router_set_timing(dr_router_t *router, int enabled) {
+    __atomic_store_n(&router->timed, enabled != 0, __ATOMIC_RELAXED);
+}
+
+void dr_set_timing(int enabled) {
+    dr_router_set_timing(default_router, enabled);
+}
+
+int dr_router_subscribe_routes(dr_router_t *router, dr_route_listener_t fn, void *user) {
+    rmutex_lock(&router->coarse_lock);
+    route_listener_t *grown = (route_listener_t *) dr_realloc(router->listeners,
+                                                           (router->listener_count + 1) * sizeof(route_listener_t));
+    if (grown == NULL) {
+        rmutex_unlock(&router->coarse_lock);
+        return -1;
+    }
+    router->listeners = grown;
+
+    /* bring everyone else up to date, then tell the newcomer about every usable route */
+    announce_changes(router);
+    router->listeners[router->listener_count].fn = fn;
+    router->listeners[router->listener_count].user = user;
+    router->listener_count++;
+    for (route_t *r = router->head; r != NULL; r = r->next) {
+        if (r->announced) {
+            dr_route_t route;
+            route.prefix = r->subnet;
+            route.mask = r->mask;
+            route.hop = r->announced_hop;
+            route.cost = r->announced_cost;
+            fn(user, DR_ROUTE_ADD, &route);
+        }
+    }
+    rmutex_unlock(&router->coarse_lock);
+    return 0;
+}
+
+void dr_router_unsubscribe_routes(dr_router_t *router, dr_route_listener_t fn, void *user) {
+    rmutex_lock(&router->coarse_lock);
+    for (unsigned i = 0; i < router->listener_count; i++)
+        if (router->listeners[i].fn == fn && router->listeners[i].user == user) {
+            router->listeners[i] = router->listeners[--router->listener_count];
+            break;
+        }
+    rmutex_unlock(&router->coarse_lock);
+}
+
+int dr_subscribe_routes(dr_route_listener_t fn, void *user) {
+    return dr_router_subscribe_routes(default_router, fn, user);
+}
+
+void dr_unsubscribe_routes(dr_route_listener_t fn, void *user) {
+    dr_router_unsubscribe_routes(default_router, fn, user);
+}
+
+void dr_router_set_aggregation(dr_router_t *router, int enabled) {
+    rmutex_lock(&router->coarse_lock);
+    router->aggregate = enabled != 0;
+    router->table_version++; /* so that the next advertisements are merged with it */
+    capture_config(router);
+    rmutex_unlock(&router->coarse_lock);
+}
+
+void dr_set_aggregation(int enabled) {
+    dr_router_set_aggregation(default_router, enabled);
+}
+
+void dr_router_set_fib_compression(dr_router_t *router, int enabled) {
+    rmutex_lock(&router->coarse_lock);
+    router->compress_fib = enabled != 0;
+    router->fib_dirty = true;
+    rebuild_fib(router);
+    capture_config(router);
+    rmutex_unlock(&router->coarse_lock);
+}
+
+void dr_set_fib_compression(int enabled) {
+    dr_router_set_fib_compression(default_router, enabled);
+}
+
+void dr_router_set_route_limits(dr_router_t *router, const dr_route_limits_t *limits) {
+    rmutex_lock(&router->coarse_lock);
+    router->limits = *limits;
+    router->table_version++; /* so that the next advertisements are merged under them */
+    capture_config(router);
+    rmutex_unlock(&router->coarse_lock);
+}
+
+void dr_set_route_limits(const dr_route_limits_t *limits) {
+    dr_router_set_route_limits(default_router, limits);
+}
+
+void dr_router_set_rate_limit(dr_router_t *router, const dr_rate_limit_t *limit) {
+    rmutex_lock(&router->coarse_lock);
+    router->rate_limit = *limit;
+    capture_config(router);
+    rmutex_unlock(&router->coarse_lock);
+}
+
+void dr_set_rate_limit(const dr_rate_limit_t *limit) {
+    dr_router_set_rate_limit(default_router, limit);
+}
+
+int dr_router_capture(dr_router_t *router, const char *path) {
+    int result = 0;
+    rmutex_lock(&router->coarse_lock);
+    dr_capture_close(router->capture);
+    router->capture = NULL;
+    if (path != NULL) {
+        router->capture = dr_capture_open(path);
+        if (router->capture != NULL) {
+            dr_capture_write_interfaces(router->capture, DR_CAPTURE_INTERFACES, 0, dr_clock_now(), NULL, 0,
+                                        router->intfs, router->intf_total);
+            capture_config(router);
+        } else {
+            result = -1;
+        }
+    }
+    rmutex_unlock(&router->coarse_lock);
+    return result;
+}
+
+int dr_capture(const char *path) {
+    return dr_router_capture(default_router, path);
+}
+
+int dr_router_export_pcap(dr_router_t *router, const char *path) {
+    int result = 0;
+    rmutex_lock(&router->coarse_lock);
+    dr_pcap_close(router->pcap);
+    router->pcap = NULL;
+    if (path != NULL) {
+        router->pcap = dr_pcap_open(path);
+        if (router->pcap == NULL)
+            result = -1;
+    }
+    rmutex_unlock(&router->coarse_lock);
+    return result;
+}
+
+int dr_export_pcap(const char *path) {
+    return dr_router_export_pcap(default_router, path);
+}
+
+/* records the settings of the router in its capture file, if it has one */
+static void capture_config(dr_router_t *router) {
+    if (router->capture == NULL)
+        return;
+    dr_capture_config_t config;
+    config.aggregate = router->aggregate;
+    config.compress_fib = router->compress_fib;
+    config.max_routes = router->limits.max_routes;
+    config.max_neighbour_routes = router->limits.max_neighbour_routes;
+    config.overflow_policy = router->limits.policy;
+    config.rate = router->rate_limit.rate;
+    config.burst = router->rate_limit.burst;
+    config.rate_policy = router->rate_limit.policy;
+    dr_capture_write(router->capture, DR_CAPTURE_CONFIG, 0, dr_clock_now(), &config, sizeof(config), NULL, 0);
+}
+
+void dr_get_stats(dr_stats_t *stats) {
+    dr_router_get_stats(default_router, stats);
+}
+
+int dr_export_stats(const char *shm_name) {
+    return dr_router_export_stats(default_router, shm_name);
 }
 
 
@@ -184,211 +783,449 @@ void dr_init(unsigned (*func_dr_interface_count)(),
                                           uint32_t outgoing_intf,
                                           char * /* borrowed */,
                                           unsigned)) {
-    pthread_t tid;
+    dr_host_t host;
 
     /* save the functions the DR is providing for us */
     dr_interface_count = func_dr_interface_count;
     dr_get_interface = func_dr_get_interface;
     dr_send_payload = func_dr_send_payload;
 
-    /* initialize the recursive mutex */
-    rmutex_init(&coarse_lock);
-
-    /* initialize the amount of time we want between callbacks */
-    secs_to_sleep_between_callbacks = 1;
-    nanosecs_to_sleep_between_callbacks = 0;
+    host.interface_count = legacy_interface_count;
+    host.get_interface = legacy_get_interface;
+    host.send_payload = legacy_send_payload;
+    host.user = NULL;
 
-    /* start a new thread to provide the periodic callbacks */
-    if (pthread_create(&tid, NULL, periodic_callback_manager_main, NULL) != 0) {
+    default_router = dr_router_create(&host);
+    if (default_router == NULL) {
         exit(1);
     }
 
+    /* record the router from the start if asked to (see dr_capture) */
+    const char *capture = getenv("DR_CAPTURE");
+    if (capture != NULL && dr_capture(capture) != 0)
+        fprintf(stderr, "dr_init: cannot capture to %s\n", capture);
+
+    /* and export its traffic (see dr_export_pcap) */
+    const char *pcap = getenv("DR_PCAP");
+    if (pcap != NULL && dr_export_pcap(pcap) != 0)
+        fprintf(stderr, "dr_init: cannot export the traffic to %s\n", pcap);
+}
+
+dr_router_t *dr_router_create(const dr_host_t *host) {
+    dr_router_t *router = (dr_router_t *) dr_calloc(1, sizeof(dr_router_t));
+    if (router == NULL)
+        return NULL;
+
+    /* initialize the recursive mutex */
+    rmutex_init(&router->coarse_lock);
+
     /* do initialization of your own data structures here */
 
-    head = NULL;
-    tail = NULL;
-    tablelength = 0;
-    lastsent = 0;
+    router->host = *host;
+    router->head = NULL;
+    router->tail = NULL;
+    router->tablelength = 0;
+    router->lastsent = 0;
+    router->fib = fib_create(FIB_AUTO);
+    router->fib_dirty = true;
+    router->routes_changed = true;
+    router->table_version = 1;
+    if (router->fib == NULL || refresh_interfaces(router) != 0) {
+        fib_destroy(router->fib);
+        free(router->intf_routes);
+        free(router->subnet_routes);
+        free(router->intfs);
+        free(router->connected);
+        free(router);
+        return NULL;
+    }
 
 
-    unsigned int intcount = dr_interface_count();
+    unsigned int intcount = intf_count(router);
 
 
     //Create first routing table entries
     for (unsigned int i = 0; i < intcount; i++) {
-        lvns_interface_t currInt = dr_get_interface(i);
+        lvns_interface_t currInt = get_intf(router, i);
 
         if (currInt.enabled) {
-            route_t *node = (route_t *) malloc(sizeof(route_t));
-            makeroute_t(node, currInt.ip, currInt.subnet_mask, currInt.cost, i, 0);
-            node->last_updated = -1;
-            addLast(node);
+            route_t *node = (route_t *) dr_malloc(sizeof(route_t));
+            if (node == NULL) {
+                dr_router_destroy(router); //frees the routes made so far
+                return NULL;
+            }
+            makeroute_t(node, currInt.ip, currInt.subnet_mask, currInt.cost, i, NULL);
+            insert_sorted(router, node);
+            router->subnet_routes[i] = node;
+            node->intf_subnet = true;
         }
     }
 
-    printf("Routing table init");
-    print_routing_table(head);
+    DR_TRACE("Routing table init");
+    print_routing_table(router->head);
+    rebuild_fib(router);
 
+    /* get periodic callbacks from the shared thread (unless whoever drives the
+       virtual clock also drives the periodic callbacks) */
+    if (!dr_clock_is_virtual())
+        periodic_register(router);
 
+    return router;
 }
 
-void makeroute_t(route_t *node, uint32_t ip, uint32_t subnet_mask, int cost, int interfnr, uint32_t next_hop_ip) {
+void dr_router_destroy(dr_router_t *router) {
+    if (router == NULL)
+        return;
+
+    /* once unregistered, the periodic thread is done with this router */
+    periodic_unregister(router);
+
+    route_t *node = router->head;
+    while (node != NULL) {
+        route_t *next = node->next;
+        while (node->paths != NULL)
+            unlink_path(node->paths);
+        free(node);
+        node = next;
+    }
+    while (router->neighbours != NULL) {
+        neighbour_t *next = router->neighbours->next;
+        free(router->neighbours->deferred_buf);
+        free(router->neighbours->last_buf);
+        free(router->neighbours);
+        router->neighbours = next;
+    }
+    free(router->intf_routes);
+    free(router->subnet_routes);
+    free(router->sorted_entries);
+    free(router->summaries);
+    free(router->payload);
+    free(router->fib_entries);
+    fib_destroy(router->fib);
+    free(router->intfs);
+    free(router->connected);
+    free(router->listeners);
+    dr_stats_page_close(router->stats_page);
+    dr_capture_close(router->capture);
+    dr_pcap_close(router->pcap);
+    rmutex_destroy(&router->coarse_lock);
+    free(router);
+}
+
+void makeroute_t(route_t *node, uint32_t ip, uint32_t subnet_mask, int cost, int interfnr, neighbour_t *via) {
 
     node->subnet = ip & subnet_mask;
     node->mask = subnet_mask;
-    node->cost = cost;
+    node->cost = cost >= INFINITY ? INFINITY : cost;
     node->outgoing_intf = interfnr;
     node->is_garbage = 0;
-    node->last_updated = get_time();
-    node->next_hop_ip = next_hop_ip;   //
+    node->via = via;
+    node->next_hop_ip = via != NULL ? via->ip : 0;   //
+    node->announced = 0;
+    node->paths = NULL;
+    node->intf_next = NULL;
+    node->intf_prev = NULL;
+    node->intf_subnet = false;
     node->next = NULL;
     node->previous = NULL;
 
 }
 
 
-next_hop_t safe_dr_get_next_hop(uint32_t ip) {
-
+next_hop_t safe_dr_get_next_hop(dr_router_t *router, uint32_t ip) {
+    /* determine the next hop in order to get to ip, from the last FIB loaded */
+    return fib_lookup(router->fib, ip);
+}
 
+/* notes that routes changed: the FIB and the route listeners are behind */
+static void table_changed(dr_router_t *router) {
+    router->fib_dirty = true;
+    router->routes_changed = true;
+    router->table_version++;
+}
 
-    /* determine the next hop in order to get to ip */
+/* tells the route listeners how the usable routes changed since last time */
+static void announce_changes(dr_router_t *router) {
+    if (!router->routes_changed)
+        return;
+    router->routes_changed = false;
+
+    for (route_t *r = router->head; r != NULL; r = r->next) {
+        bool usable = r->cost < INFINITY;
+        dr_route_event_t event;
+
+        if (usable && !r->announced)
+            event = DR_ROUTE_ADD;
+        else if (!usable && r->announced)
+            event = DR_ROUTE_WITHDRAW;
+        else if (usable && (r->announced_cost != r->cost || r->announced_hop.dst_ip != r->next_hop_ip ||
+                            r->announced_hop.interface != r->outgoing_intf))
+            event = DR_ROUTE_MODIFY;
+        else
+            continue;
+
+        r->announced = usable;
+        if (usable) {
+            r->announced_hop.dst_ip = r->next_hop_ip;
+            r->announced_hop.interface = r->outgoing_intf;
+            r->announced_cost = r->cost;
+        }
 
-    /*
-    if(ip == (uint32_t) 0x7B780000 ) {
-        printf("Dodgy comparison\n\n\n\n");
-        print_routing_table(head);
+        notify_listeners(router, event, r);
     }
-    */
+}
 
+/* tells the route listeners about the route as last announced */
+static void notify_listeners(dr_router_t *router, dr_route_event_t event, const route_t *r) {
+    dr_route_t route;
+    route.prefix = r->subnet;
+    route.mask = r->mask;
+    route.hop = r->announced_hop;
+    route.cost = r->announced_cost;
+    for (unsigned i = 0; i < router->listener_count; i++)
+        router->listeners[i].fn(router->listeners[i].user, event, &route);
+}
 
-    uint32_t maxMlen = 0;
-    route_t *lgst = NULL;
-    route_t *currEntry = head;
-    while (currEntry != NULL) {
-        if (((currEntry->subnet & currEntry->mask) == ip) && currEntry->mask > maxMlen &&
-            currEntry->cost < 16) {  //DARF ICH HIER OHNE 16 TEST
-            maxMlen = currEntry->mask;
-            lgst = currEntry;
-        }
-        currEntry = currEntry->next;
+/* loads every usable route (or the fewest prefixes equivalent to them) into the
+   FIB if the table changed since it was last loaded */
+static void rebuild_fib(dr_router_t *router) {
+    if (!router->fib_dirty)
+        return;
+    if (router->tablelength + 1 > router->fib_entries_size) {
+        unsigned size = router->tablelength + 1 > 2 * router->fib_entries_size ? router->tablelength + 1
+                                                                                : 2 * router->fib_entries_size;
+        fib_entry_t *grown = (fib_entry_t *) dr_realloc(router->fib_entries, size * sizeof(fib_entry_t));
+        if (grown == NULL)
+            return; /* stay dirty and try again on the next call */
+        router->fib_entries = grown;
+        router->fib_entries_size = size;
+    }
 
+    fib_entry_t *entries = router->fib_entries;
+    unsigned n = 0;
+    for (route_t *r = router->head; r != NULL; r = r->next) {
+        if (r->cost >= INFINITY)
+            continue;
+        entries[n].prefix = r->subnet;
+        entries[n].mask = r->mask;
+        entries[n].hop.dst_ip = r->next_hop_ip;
+        entries[n].hop.interface = r->outgoing_intf;
+        n++;
     }
-    next_hop_t hophop;
-    hophop.dst_ip = (maxMlen == 0) ? 0xFFFFFFFF : lgst->next_hop_ip;
-    hophop.interface = (maxMlen == 0) ? 0 : lgst->outgoing_intf;
-    return hophop;
+    if (router->compress_fib) {
+        int compressed = fib_compress(entries, n);
+        if (compressed >= 0)
+            n = compressed; /* else load them as they are */
+    }
+    if (fib_load(router->fib, entries, n) != 0)
+        return; /* it still has the previous routes; stay dirty and try again */
+    router->fib_dirty = false;
 }
 
-void safe_dr_handle_packet(uint32_t ip, unsigned intf,
+void safe_dr_handle_packet(dr_router_t *router, uint32_t ip, unsigned intf,
                            char *buf /* borrowed */, unsigned len) {
     /* handle the dynamic routing payload in the buf buffer */
     //ip = ntohl(ip);
 
+    //Drop packets which cannot be a whole number of entries or come from nowhere
+    if (len % sizeof(rip_entry_t) != 0 || (buf == NULL && len != 0) || intf >= intf_count(router)) {
+        DR_TRACE("Malformed packet dropped (intf %u, %u bytes)\n", intf, len);
+        return;
+    }
+
     //Falls interface zu diesem router deaktiviert, table irrelevant
-    if (!dr_get_interface(intf).enabled) {
+    if (!get_intf(router, intf).enabled) {
         //free(buf);
         return;
     }
 
-    bool tablechanged = false;
-    unsigned intfc = dr_get_interface(intf).cost; //current interface cost
+    dr_intf_stats_t *stats = intf_stats(router, intf);
+    stats->adverts_rx++;
+    stats->bytes_rx += len;
+    long now = dr_clock_now();
+
+    //Hearing from the neighbour keeps all routes learned from it alive
+    neighbour_t *neighbour = find_neighbour(router, intf, ip);
+    if (neighbour == NULL)
+        return; //out of memory; its next advertisement will do
+    neighbour->last_heard = now;
+    neighbour->expired = false;
+
+    //A neighbour advertising faster than its token bucket allows is not listened to
+    //for now; each advertisement is its whole table, so only the last one is kept
+    if (!take_token(router, neighbour, now)) {
+        if (neighbour->deferred)
+            stats->adverts_dropped++; //superseded by this one
+        if (router->rate_limit.policy == DR_RATE_DEFER && defer_advert(neighbour, buf, len) == 0) {
+            stats->adverts_deferred++;
+        } else {
+            neighbour->deferred = false;
+            stats->adverts_dropped++;
+        }
+        return;
+    }
+    if (neighbour->deferred) {
+        neighbour->deferred = false;
+        stats->adverts_dropped++;
+    }
 
+    merge_advert(router, neighbour, buf, len, now);
+}
 
+// merges an advertisement of the neighbour into the table, and sends ours if that
+// changed it
+static void merge_advert(dr_router_t *router, neighbour_t *neighbour, char *buf, unsigned len, long now) {
+    uint32_t ip = neighbour->ip;
+    unsigned intf = neighbour->intf;
+    dr_intf_stats_t *stats = intf_stats(router, intf);
+    bool tablechanged = false;
+    unsigned intfc = get_intf(router, intf).cost; //current interface cost
+    if (intfc > INFINITY)
+        intfc = INFINITY; //so that metric + intfc cannot wrap around
     rip_entry_t *payload = (rip_entry_t *) buf;
 
+    //Merging the same advertisement into the same table again changes nothing, so
+    //in steady state hearing the neighbour is all there is to do
+    uint32_t fingerprint = dr_crc32c(0, buf, len);
+    if (neighbour->remembered && neighbour->fingerprint_version == router->table_version &&
+        neighbour->last_len == len && neighbour->fingerprint == fingerprint &&
+        (len == 0 || memcmp(neighbour->last_buf, buf, len) == 0)) {
+        stats->adverts_unchanged++;
+        return;
+    }
 
-    int nrofentries = len / sizeof(rip_entry_t); //anzahl tabelleneitnräge
-
-    rip_entry_t *entry = payload;
-
-    printf("==============================\n");
-    printf("Packet incomming...\n\n");
 
-    //bool garbageset = false;
+    int nrofentries = len / sizeof(rip_entry_t); //anzahl tabelleneitnräge
+    stats->entries_rx += nrofentries;
 
+    //Sort the entries by prefix so that they can be merged with the (sorted) table
+    //in one pass
+    int sorted = sort_entries(router, payload, nrofentries);
+    if (sorted < 0)
+        return; //out of memory; its next advertisement will do
+    rip_entry_t **entries = router->sorted_entries;
+    neighbour->adverts++;
 
-    for (int i = 0; i < nrofentries; i++) {
+    //How many routes of each prefix length may be taken from the neighbour
+    unsigned quota[33];
+    neighbour_quota(router, entries, sorted, quota);
 
+    DR_TRACE("==============================\n");
+    DR_TRACE("Packet incomming...\n\n");
 
-        route_t *current = head;
-        bool addentry = true;
+    //bool garbageset = false;
 
+    route_t *current = router->head;
+    unsigned summary = 0;
+    for (int i = 0; i < sorted; i++) {
+        rip_entry_t *entry = entries[i];
+        uint64_t key = entry_key(entry);
+
+        //A prefix we summarize ourselves can only have come back round a loop
+        while (summary < router->summary_count && router->summaries[summary] < key)
+            summary++;
+        if (summary < router->summary_count && router->summaries[summary] == key)
+            continue;
+
+        //Beyond its quota the neighbour's routes are ignored, so it withdraws them
+        if (entry->metric < INFINITY) {
+            unsigned length = __builtin_popcount(entry->subnet_mask);
+            if (quota[length] == 0) {
+                stats->routes_rejected++;
+                continue;
+            }
+            quota[length]--;
+        }
 
-        while (current != NULL) {
+        while (current != NULL && prefix_key(current->subnet, current->mask) < key)
+            current = current->next;
 
-            //Case 1: Entry in table
-            if ((entry->subnet_mask & entry->ip) == (current->subnet & current->mask)) {
-                addentry = false;
+        //Case 1: Entry in table
+        if (current != NULL && prefix_key(current->subnet, current->mask) == key) {
+            record_path(current, neighbour, entry);
 
-                //Case 1.1: If table received from interface which is outgoing interface of entry always adjust
-                if (current->outgoing_intf == intf && current->next_hop_ip != 0) {
+            //Case 1.1: If table received from the next hop of the entry always adjust
+            if (current->via == neighbour) {
 
-                    unsigned int oldcost = current->cost;
+                unsigned int oldcost = current->cost;
 
-                    current->cost = (entry->metric + intfc >= 16) ? 16 : entry->metric + intfc; //aktualisiere kos
-                    current->is_garbage = (current->cost == 16) ? 1 : 0;
-                    //if(current->is_garbage)
-                    //    garbageset = true;
-                    current->last_updated = get_time();
+                current->cost = (entry->metric + intfc >= 16) ? 16 : entry->metric + intfc; //aktualisiere kos
+                current->is_garbage = (current->cost == 16) ? 1 : 0;
+                //if(current->is_garbage)
+                //    garbageset = true;
 
-                    if (oldcost != current->cost)
-                        tablechanged = true; //eventuell too much
+                if (oldcost != current->cost)
+                    tablechanged = true; //eventuell too much
 
-                }
+                //If the route got worse, a loop-free alternate may now be better
+                if (current->cost > oldcost && fail_over(router, current, oldcost, now))
+                    tablechanged = true;
 
-                    //Case 1.2: If new route proposed than outgoing interface of current entry
-                else if (current->outgoing_intf != intf) {
+            }
 
-                    //Adjust only if route faster
-                    if (entry->metric + intfc < current->cost) {
-                        current->cost = entry->metric + intfc;
-                        current->outgoing_intf = intf;
-                        current->next_hop_ip = ip; //nicht immer nötig aber schadet nicht
-                        current->last_updated = get_time();
-                        current->is_garbage = 0;
-                        tablechanged = true;
+                //Case 1.2: If new route proposed by another neighbour
+            else {
 
-                    }
+                //Adjust only if route faster
+                if (entry->metric + intfc < current->cost) {
+                    current->cost = entry->metric + intfc;
+                    set_next_hop(router, current, intf, neighbour); //nicht immer nötig aber schadet nicht
+                    current->is_garbage = 0;
+                    tablechanged = true;
+                    stats->routes_learned++;
 
                 }
-                break;
 
             }
-            current = current->next;
+
         }
 
         //Case 2:If destination not yet in table //nur anfügen falls total kosten <= 15
-        if (addentry && (entry->metric + intfc <= 15)) {
-            route_t *node = (route_t *) malloc(sizeof(route_t));
-            makeroute_t(node, entry->ip, entry->subnet_mask, entry->metric + intfc, intf, ip);
-            addLast(node);
+        else if (entry->metric + intfc <= 15) {
+            if (!make_room(router, entry->subnet_mask, &current)) {
+                stats->routes_rejected++;
+                continue;
+            }
+            route_t *node = (route_t *) dr_malloc(sizeof(route_t));
+            if (node == NULL)
+                continue; //out of memory; its next advertisement will do
+            makeroute_t(node, entry->ip, entry->subnet_mask, entry->metric + intfc, intf, neighbour);
+            insert_before(router, node, current);
+            record_path(node, neighbour, entry);
+            current = node; //a later entry may be for the same prefix
             tablechanged = true;
+            stats->routes_learned++;
         }
-        entry++;
 
     }
 
 
+    //Whatever the neighbour did not advertise again is withdrawn
+    if (withdraw_unheard(router, neighbour, now))
+        tablechanged = true;
+
     if (tablechanged) {
-        //printf("==============================\n");
-        printf("Table has changed!\n\n");
-        printf("Packet that changed table: \n");
+        //DR_TRACE("==============================\n");
+        DR_TRACE("Table has changed!\n\n");
+        DR_TRACE("Packet that changed table: \n");
         print_rippacket(ip, intf, payload, nrofentries);
-        printf("==============================\n");
-        printf("Routing table after receiving paket:\n");
-        print_routing_table(head);
-        printf("==============================\n");
+        DR_TRACE("==============================\n");
+        DR_TRACE("Routing table after receiving paket:\n");
+        print_routing_table(router->head);
+        DR_TRACE("==============================\n");
     } else {
-        //printf("==============================\n");
-        printf("Table has not changed!\n");
-        printf("==============================\n");
+        //DR_TRACE("==============================\n");
+        DR_TRACE("Table has not changed!\n");
+        DR_TRACE("==============================\n");
     }
 
     //free(buf);
     //sende aktualisierten table
     if (tablechanged) {
-        send_table();
+        table_changed(router);
+        send_table(router, true);
     }
+    remember_advert(router, neighbour, buf, len, fingerprint);
 
 
     //if(garbageset)
@@ -401,27 +1238,27 @@ void safe_dr_handle_packet(uint32_t ip, unsigned intf,
 //Implement
 /*
 void clearup_table() {
-    printf("Clearup called\n");
-    printf("Tablelength %d\n",tablelength);
+    DR_TRACE("Clearup called\n");
+    DR_TRACE("Tablelength %d\n",tablelength);
     print_routing_table(head);
     int counter = 0;
 
     route_t* current = head;
     while (current != NULL) {
         if (current->is_garbage) {
-            printf("Entry %d delete\n",counter);
+            DR_TRACE("Entry %d delete\n",counter);
             counter++;
             removeNode(current);
             current = head;
             counter = 0;
         } else {
-            printf("Entry %d not delete\n",counter);
+            DR_TRACE("Entry %d not delete\n",counter);
             counter++;
             current = current->next;
         }
     }
 
-    printf("Clearup returned\n");
+    DR_TRACE("Clearup returned\n");
 
 }
  */
@@ -440,16 +1277,30 @@ void addFirst(route_t* node) {
 
 **/
 
-void addLast(route_t *node) {
-    if (tablelength == 0) {
-        head = node;
+// inserts the node into the table in front of before (at the end if NULL);
+// the table is kept sorted by prefix
+void insert_before(dr_router_t *router, route_t *node, route_t *before) {
+    node->next = before;
+    node->previous = before != NULL ? before->previous : router->tail;
+    if (node->previous != NULL)
+        node->previous->next = node;
+    else
+        router->head = node;
+    if (before != NULL)
+        before->previous = node;
+    else
+        router->tail = node;
+    router->tablelength++;
+    intf_list_add(router, node);
+}
 
-    } else {
-        tail->next = node;
-        node->previous = tail;
-    }
-    tail = node;
-    tablelength++;
+// inserts the node into the table where its prefix belongs
+void insert_sorted(dr_router_t *router, route_t *node) {
+    uint64_t key = prefix_key(node->subnet, node->mask);
+    route_t *before = router->head;
+    while (before != NULL && prefix_key(before->subnet, before->mask) < key)
+        before = before->next;
+    insert_before(router, node, before);
 }
 
 /**
@@ -465,14 +1316,14 @@ void getNode(route_t* node, int index) {
 
 void removeNode(route_t* node) {
     if(tablelength == 1) {
-        printf("Case 0\n");
+        DR_TRACE("Case 0\n");
         head = NULL;
         tail = NULL;
         tablelength = 0;
         free(node);
         node = NULL;
     } else if (node == head) {
-        printf("Case 1\n");
+        DR_TRACE("Case 1\n");
         head = node->next;
         head->previous = NULL;
         free(node);
@@ -480,14 +1331,14 @@ void removeNode(route_t* node) {
         tablelength--;
 
     } else if(node == tail) {
-        printf("Case 2\n");
+        DR_TRACE("Case 2\n");
         tail = node->previous;
         tail->next = NULL;
         free(node);
         node = NULL;
         tablelength--;
     } else {
-        printf("Case 3\n");
+        DR_TRACE("Case 3\n");
         node->previous->next = node->next;
         route_t* fonext = node->next;
         node->next->previous = node->previous;
@@ -529,19 +1380,40 @@ void clear() {
 
 
 //Implement
-static void send_table() {
+static void send_table(dr_router_t *router, bool triggered) {
 
 
-    unsigned int intfcount = dr_interface_count();
+    unsigned int intfcount = intf_count(router);
+    router->summary_count = 0;
+
+    //The host only borrows the advertisement, so the buffer is kept for the next one
+    if (router->tablelength > router->payload_size) {
+        unsigned size = router->tablelength > 2 * router->payload_size ? router->tablelength : 2 * router->payload_size;
+        rip_entry_t *grown = (rip_entry_t *) dr_realloc(router->payload, size * sizeof(rip_entry_t));
+        if (grown == NULL)
+            return; //out of memory; the next periodic advertisement will do
+        router->payload = grown;
+        router->payload_size = size;
+    }
+    //Each interface adds fewer summaries than there are routes, and all of them
+    //together are fewer too once duplicates are dropped, so after the first
+    //interface there is room for the summaries of the next one
+    if (router->aggregate && 2 * router->payload_size > router->summaries_size) {
+        uint64_t *grown = (uint64_t *) dr_realloc(router->summaries, 2 * router->payload_size * sizeof(uint64_t));
+        if (grown == NULL)
+            return; //out of memory; the next periodic advertisement will do
+        router->summaries = grown;
+        router->summaries_size = 2 * router->payload_size;
+    }
 
     //Erstelle für jedes Interface das Routing table und schickt dieses raus
     for (unsigned int j = 0; j < intfcount; j++) {
 
-        lvns_interface_t currInt = dr_get_interface(j);
+        lvns_interface_t currInt = get_intf(router, j);
         if (currInt.enabled) {
 
-            rip_entry_t *payload = (rip_entry_t *) malloc(tablelength * sizeof(rip_entry_t));
-            route_t *current = head;
+            rip_entry_t *payload = router->payload;
+            route_t *current = router->head;
 
 
             rip_entry_t *entry = payload;
@@ -550,6 +1422,7 @@ static void send_table() {
                 entry->subnet_mask = current->mask;
                 entry->metric = current->cost >= 16 ? 16 : current->cost; //+ currInt.cost;
                 entry->next_hop = current->next_hop_ip;
+                entry->addr_family = htons(AF_INET);
                 entry->pad = 0;
 
 
@@ -562,80 +1435,159 @@ static void send_table() {
                 entry++;  //funktioniert das so? wahsch memcpy
                 current = current->next;
             }
-            // print_routing_table(head);
+            if (router->aggregate) {
+                entry = payload + aggregate_entries(router, payload, entry - payload);
+                unique_summaries(router);
+            }
+            // print_routing_table(router->head);
+
+            int size = (entry - payload) * sizeof(rip_entry_t);
 
-            int size = tablelength * sizeof(rip_entry_t);
 
+            send_payload(router, RIP_IP, RIP_IP, j, (char *) payload, size);
+            DR_TRACE("Packet leaving\n\n");
 
-            dr_send_payload(RIP_IP, RIP_IP, j, (char *) payload, size);
-            printf("Packet leaving\n\n");
-            //print_rippacket(RIP_IP,j,payload,tablelength);
+            dr_intf_stats_t *stats = intf_stats(router, j);
+            stats->adverts_tx++;
+            stats->bytes_tx += size;
+            if (triggered)
+                stats->triggered_tx++;
+            else
+                stats->periodic_tx++;
+            //print_rippacket(RIP_IP,j,payload,router->tablelength);
         }
+    }
 
+    //Other summaries filter what the neighbours advertise differently, so what
+    //they repeat must be merged again
+    uint32_t crc = dr_crc32c(0, router->summaries, router->summary_count * sizeof(uint64_t));
+    if (crc != router->summaries_crc) {
+        router->summaries_crc = crc;
+        router->table_version++;
     }
+}
 
+// sorts the summaries for the merge and keeps each once (the interfaces share them)
+static void unique_summaries(dr_router_t *router) {
+    if (router->summary_count < 2)
+        return;
+    qsort(router->summaries, router->summary_count, sizeof(uint64_t), cmp_key);
+    unsigned n = 1;
+    for (unsigned i = 1; i < router->summary_count; i++)
+        if (router->summaries[i] != router->summaries[n - 1])
+            router->summaries[n++] = router->summaries[i];
+    router->summary_count = n;
 }
 
-void safe_dr_handle_periodic() {
-    /* handle periodic tasks for dynamic routing here */
-    //printf("==============================\n");
-    //printf("Periodic call!\n\n");
+static int cmp_key(const void *a, const void *b) {
+    uint64_t x = *(const uint64_t *) a, y = *(const uint64_t *) b;
+    return x < y ? -1 : x > y;
+}
 
+// remembers that the prefix is advertised as a summary; false if there is no
+// room (send_table makes enough)
+static bool add_summary(dr_router_t *router, const rip_entry_t *entry) {
+    if (router->summary_count == router->summaries_size)
+        return false;
+    router->summaries[router->summary_count++] = entry_key(entry);
+    return true;
+}
 
+// whether the entries would lead the receiver the same way (or are poisoned
+// the same way)
+static bool same_route(const rip_entry_t *a, const rip_entry_t *b) {
+    return a->metric == b->metric && a->next_hop == b->next_hop;
+}
 
-    bool send = false;
-    //bool callclearup = false;
+// whether the prefix of outer contains the prefix of inner
+static bool covers(const rip_entry_t *outer, const rip_entry_t *inner) {
+    uint32_t mask = ntohl(outer->subnet_mask);
+    return (ntohl(inner->subnet_mask) & mask) == mask && (inner->ip & outer->subnet_mask) == outer->ip;
+}
 
-    //If timer run out set destination to unreachable
-    route_t *curr = head;
-    while (curr != NULL) {
-        long now = get_time();
-
-        //Timeout only if not directly connected ?
-        if (curr->last_updated + RIP_TIMEOUT_SEC * 1000 < now && curr->last_updated != -1) {
-
-            //Check if good way directly connected instead when timeout
-            bool bad = true;
-            int intcount = dr_interface_count();
-            for (int i = 0; i < intcount; i++) {
-                lvns_interface_t currInt = dr_get_interface(i);
-                if (currInt.enabled && (currInt.subnet_mask & currInt.ip) == (curr->subnet & curr->mask) &&
-                    currInt.cost < 16) {
-                    curr->last_updated = -1;
-                    curr->is_garbage = 0;
-                    curr->outgoing_intf = i;
-                    curr->next_hop_ip = 0;
-                    bad = false;
-                    break;
-                }
-            }
-            if (bad) {
-                curr->cost = 16;
-                curr->last_updated = now;
-                send = true;
+// summarizes the entries (sorted by prefix) in place and returns how many are
+// left: two halves of a prefix reached the same way are replaced by it,
+// repeatedly, unless the prefix is in the table itself, and an entry within
+// such a summary which is reached the same way is dropped.  Routes of the
+// table never hide one another, as one may be a summary heard from a neighbour.
+// Under route limits only the directly connected routes are merged (see
+// dr_set_aggregation).  The reachable merged prefixes are added to the
+// summaries.
+static unsigned aggregate_entries(dr_router_t *router, rip_entry_t *entries, unsigned count) {
+    unsigned nest[33];  //the entries kept so far which contain one another
+    bool summary[33];   //whether each of them was merged here
+    unsigned depth = 0;
+    unsigned n = 0;
+    bool limited = router->limits.max_routes != 0 || router->limits.max_neighbour_routes != 0;
+
+    for (unsigned i = 0; i < count; i++) {
+        rip_entry_t entry = entries[i];
+        bool merged_here = false;
+        for (;;) {
+            while (depth > 0 && !covers(&entries[nest[depth - 1]], &entry))
+                depth--;
+            if (depth > 0 && summary[depth - 1] && same_route(&entries[nest[depth - 1]], &entry))
+                break;  //the receiver gets there through the covering summary
+
+            //The table is sorted, so the other half of a prefix comes right before,
+            //and the prefix itself (if it is in the table) is the innermost which
+            //contains it
+            uint32_t mask = ntohl(entry.subnet_mask);
+            uint32_t half = mask & (0 - mask); //the last bit of the prefix
+            rip_entry_t *low = n > 0 ? &entries[n - 1] : NULL;
+            bool halves = low != NULL && mask != 0 && low->subnet_mask == entry.subnet_mask &&
+                          same_route(low, &entry) && (entry.next_hop == 0 || !limited) &&
+                          (ntohl(low->ip) & half) == 0 && (ntohl(low->ip) ^ ntohl(entry.ip)) == half;
+            rip_entry_t merged = entry;
+            merged.subnet_mask = htonl(mask - half);
+            merged.ip &= merged.subnet_mask;
+            if (!halves || (depth > 0 && entries[nest[depth - 1]].subnet_mask == merged.subnet_mask) ||
+                (merged.metric < INFINITY && !add_summary(router, &merged))) {
+                entries[n] = entry;
+                summary[depth] = merged_here;
+                nest[depth++] = n++;
+                break;
             }
+
+            n--;  //the lower half
+            entry = merged;
+            merged_here = true;
         }
-        if (curr->cost == 16) {
-            curr->is_garbage = 1;
-            //callclearup = true;
-        }
+    }
+    return n;
+}
 
+void safe_dr_handle_periodic(dr_router_t *router) {
+    /* handle periodic tasks for dynamic routing here */
+    //DR_TRACE("==============================\n");
+    //DR_TRACE("Periodic call!\n\n");
 
-        curr = curr->next;
-    }
+
+
+    bool send = false;
+    bool triggered = true;
+    //bool callclearup = false;
+
+    //Merge the advertisements deferred by the rate limit, as far as it allows now
+    long now = dr_clock_now();
+    merge_deferred(router, now);
+
+    //If a neighbour fell silent set the destinations learned from it to unreachable
+    if (expire_neighbours(router, now))
+        send = true;
 
     //If more than 10s passed since las periodic update
-    long now = get_time();
-    if (lastsent + RIP_ADVERT_INTERVAL_SEC * 1000 < now) {
+    if (router->lastsent + RIP_ADVERT_INTERVAL_SEC * 1000 < now) {
         send = true;
-        lastsent = now;
+        triggered = false;
+        router->lastsent = now;
     }
 
     if (send) {
-        printf("Periodic sending packet!\n\n");
-        send_table();
-        printf("Current table:!\n\n");
-        print_routing_table(head);
+        DR_TRACE("Periodic sending packet!\n\n");
+        send_table(router, triggered);
+        DR_TRACE("Current table:!\n\n");
+        print_routing_table(router->head);
     }
 
     /*
@@ -646,13 +1598,20 @@ void safe_dr_handle_periodic() {
 
 }
 
-static void safe_dr_interface_changed(unsigned intf,
+static void safe_dr_interface_changed(dr_router_t *router,
+                                      unsigned intf,
                                       int state_changed,
                                       int cost_changed) {
     /* handle an interface going down or being brought up */
 
 
-    lvns_interface_t interfa = dr_get_interface(intf);
+    //An interface the snapshot does not have (it may be out of date if out of
+    //memory) has no routes to change
+    if (intf >= intf_count(router))
+        return;
+
+    lvns_interface_t interfa = get_intf(router, intf);
+    long now = dr_clock_now();
 
     bool send = false;
     bool addEntry = true;
@@ -663,164 +1622,826 @@ static void safe_dr_interface_changed(unsigned intf,
         //Case 1.1: If now turned off
         if (!interfa.enabled) {
             addEntry = false;
-            printf("Interface down - NR: %d IP: ", intf);
+            DR_TRACE("Interface down - NR: %d IP: ", intf);
             print_ip(interfa.ip);
 
-            route_t *node = head;
-            for (unsigned int i = 0; i < tablelength; i++) {
-
-                //Set all destinations that hat current interface as outgoing hop to unreachable
-                if (node->outgoing_intf == intf) {
-                    node->cost = 16;
-                    node->is_garbage = 1;
-                   // garbageset = true;
-                    node->last_updated = get_time();
-                    send = true;
-
-                }
-                node = node->next;
-
+            //Switch all destinations that hat current interface as outgoing hop to their
+            //alternate, or set them to unreachable
+            route_t *node = intf < router->intf_routes_size ? router->intf_routes[intf] : NULL;
+            while (node != NULL) {
+                route_t *next = node->intf_next; //fail_over moves node to another list
+                uint32_t feasible = node->cost;
+                node->cost = 16;
+                node->is_garbage = 1;
+                // garbageset = true;
+                fail_over(router, node, feasible, now);
+                send = true;
+                node = next;
             }
             //Case 1.2: If now turned on
         } else {
 
-            printf("Interface up - NR: %d IP: ", intf);
+            DR_TRACE("Interface up - NR: %d IP: ", intf);
             print_ip(interfa.ip);
 
-            route_t *node = head;
-            for (unsigned int i = 0; i < tablelength; i++) {
-
-                //Check for this interface if now faster with direct connection
-                if ((node->subnet & node->mask) == (interfa.ip & interfa.subnet_mask)) {
-                    addEntry = false; //Entry in table
-
-                    if (interfa.cost < node->cost) {
-                        node->outgoing_intf = intf;
-                        node->cost = interfa.cost;
-                        node->next_hop_ip = 0;
-                        node->last_updated = get_time();
-                        node->mask = interfa.subnet_mask;
-                        send = true;
-                        break;
-                    }
+            //Check for this interface if now faster with direct connection
+            route_t *node = intf_subnet_route(router, intf);
+            if (node != NULL) {
+                addEntry = false; //Entry in table
 
+                if (interfa.cost < node->cost) {
+                    set_next_hop(router, node, intf, NULL);
+                    node->cost = interfa.cost;
+                    send = true;
                 }
-                node = node->next;
-
             }
 
 
         }
         //Case 2: Cost changed
     } else if (cost_changed) {
-        route_t *node = head;
-        unsigned int oldcost = 0;
-
-
+        DR_TRACE("Interface cost change - NR: %d IP: ", intf);
+        print_ip(htonl(interfa.ip));
+        DR_TRACE("NewCost: %d\n", interfa.cost);
 
+        //Recompute the routes reached or learned over this interface, and its own subnet,
+        //from what the neighbours advertised
+        route_t *node = intf_subnet_route(router, intf);
+        if (node != NULL) {
+            addEntry = false;
+            if (select_best(router, node, now))
+                send = true;
+        }
 
-        //get old cost to reach this subnet
+        node = intf < router->intf_routes_size ? router->intf_routes[intf] : NULL;
         while (node != NULL) {
+            route_t *next = node->intf_next; //select_best may move node to another list
+            if (select_best(router, node, now))
+                send = true;
+            node = next;
+        }
 
-            if ((interfa.ip & interfa.subnet_mask) == (node->subnet & node->mask)) {
-                oldcost = node->cost;
-                addEntry = false;
+        for (neighbour_t *n = router->neighbours; n != NULL; n = n->next) {
+            if (n->intf != intf)
+                continue;
+            for (path_t *path = n->paths; path != NULL; path = path->nbr_next)
+                if (select_best(router, path->route, now))
+                    send = true;
+        }
+    }
+
+    //If not found in table then add (unless out of memory; then the subnet is
+    //added when the interface changes again)
+    if (addEntry) {
+        route_t *node = (route_t *) dr_malloc(sizeof(route_t));
+        if (node != NULL) {
+            makeroute_t(node, interfa.ip, interfa.subnet_mask, interfa.cost, intf, NULL);
+            insert_sorted(router, node);
+            router->subnet_routes[intf] = node;
+            node->intf_subnet = true;
+            send = true;
+        }
+    }
+    print_routing_table(router->head);
+    if (send) {
+        table_changed(router);
+        send_table(router, true);
+    } else {
+        //The table is as it was, but a neighbour on the interface repeating its
+        //advertisement must still have it merged under the new cost or state
+        for (neighbour_t *n = router->neighbours; n != NULL; n = n->next)
+            if (n->intf == intf) {
+                router->table_version++;
                 break;
             }
-            node = node->next;
+    }
+    /*
+    if(garbageset)
+        clearup_table();
+    */
 
-        }
 
-        printf("Interface cost change - NR: %d IP: ", intf);
-        print_ip(htonl(interfa.ip));
-        printf("Oldcost:  %d NewCost: %d\n", oldcost, interfa.cost);
 
 
 
-        //Go through all nodes that have the interface that has changed as outgoing and adjust costs
-        node = head;
-        while (node != NULL) {
-            if (node->outgoing_intf == intf) {
-                if (node->next_hop_ip != 0)
-                    node->cost -= (oldcost - interfa.cost);//lower costs by difference between old costs and new costs
-                else
-                    node->cost = interfa.cost;
-                node->last_updated = get_time();
-                send = true;
-                if (node->cost >= 16) {
-                    node->cost = 16;
-                    node->is_garbage = 1;
-                    //garbageset = true;
-                }
-            }
-            node = node->next;
 
+
+}
+
+/* definition of internal functions */
+
+// returns the neighbour with the ip on intf, adding it if it is new (NULL if
+// out of memory)
+static neighbour_t *find_neighbour(dr_router_t *router, unsigned intf, uint32_t ip) {
+    for (neighbour_t *n = router->neighbours; n != NULL; n = n->next)
+        if (n->ip == ip && n->intf == intf)
+            return n;
+
+    neighbour_t *n = (neighbour_t *) dr_malloc(sizeof(neighbour_t));
+    if (n == NULL)
+        return NULL;
+    n->ip = ip;
+    n->intf = intf;
+    n->last_heard = 0;
+    n->expired = false;
+    n->adverts = 0;
+    n->path_count = 0;
+    n->remembered = false;
+    n->fingerprint = 0;
+    n->fingerprint_version = 0;
+    n->last_buf = NULL;
+    n->last_len = 0;
+    n->last_size = 0;
+    n->paths = NULL;
+    n->tokens = UINT64_MAX / 2; /* a full bucket, whatever its size */
+    n->bucket_time = 0;
+    n->deferred = false;
+    n->deferred_buf = NULL;
+    n->deferred_len = 0;
+    n->deferred_size = 0;
+    n->next = router->neighbours;
+    router->neighbours = n;
+    return n;
+}
+
+// adds the tokens the neighbour earned since they were last added (up to the
+// burst) and takes one for an advertisement; returns false if there was none
+static bool take_token(dr_router_t *router, neighbour_t *neighbour, long now) {
+    const dr_rate_limit_t *limit = &router->rate_limit;
+    if (limit->rate == 0)
+        return true;
+
+    uint64_t full = (uint64_t) (limit->burst > 0 ? limit->burst : 1) * 1000;
+    if (now > neighbour->bucket_time)
+        neighbour->tokens += (uint64_t) (now - neighbour->bucket_time) * limit->rate;
+    neighbour->bucket_time = now;
+    if (neighbour->tokens > full)
+        neighbour->tokens = full;
+    if (neighbour->tokens < 1000)
+        return false;
+    neighbour->tokens -= 1000;
+    return true;
+}
+
+// keeps a copy of the advertisement to merge once the neighbour has a token
+// again; returns -1 if out of memory
+static int defer_advert(neighbour_t *neighbour, const char *buf, unsigned len) {
+    if (len > neighbour->deferred_size) {
+        char *grown = (char *) dr_realloc(neighbour->deferred_buf, len);
+        if (grown == NULL)
+            return -1;
+        neighbour->deferred_buf = grown;
+        neighbour->deferred_size = len;
+    }
+    if (len > 0)
+        memcpy(neighbour->deferred_buf, buf, len);
+    neighbour->deferred_len = len;
+    neighbour->deferred = true;
+    return 0;
+}
+
+// keeps a copy of the advertisement just merged, so that a repetition of it can
+// be skipped; forgets the last one instead if out of memory
+static void remember_advert(dr_router_t *router, neighbour_t *neighbour, const char *buf, unsigned len,
+                            uint32_t fingerprint) {
+    neighbour->remembered = false;
+    if (len > neighbour->last_size) {
+        char *grown = (char *) dr_realloc(neighbour->last_buf, len);
+        if (grown == NULL)
+            return;
+        neighbour->last_buf = grown;
+        neighbour->last_size = len;
+    }
+    if (len > 0)
+        memcpy(neighbour->last_buf, buf, len);
+    neighbour->last_len = len;
+    neighbour->fingerprint = fingerprint;
+    neighbour->fingerprint_version = router->table_version;
+    neighbour->remembered = true;
+}
+
+// merges the deferred advertisements of the neighbours which have a token now
+static void merge_deferred(dr_router_t *router, long now) {
+    for (neighbour_t *n = router->neighbours; n != NULL; n = n->next) {
+        if (!n->deferred || !take_token(router, n, now))
+            continue;
+        n->deferred = false;
+        if (n->intf < intf_count(router) && get_intf(router, n->intf).enabled)
+            merge_advert(router, n, n->deferred_buf, n->deferred_len, now);
+    }
+}
+
+// stores what the neighbour advertised for the route in its current
+// advertisement; a metric of INFINITY withdraws it
+static void record_path(route_t *route, neighbour_t *neighbour, const rip_entry_t *entry) {
+    uint32_t metric = entry->metric;
+    path_t *path = route->paths;
+    while (path != NULL && path->neighbour != neighbour)
+        path = path->next;
+
+    if (metric >= INFINITY) {
+        if (path != NULL)
+            unlink_path(path);
+        return;
+    }
+
+    if (path == NULL) {
+        path = (path_t *) dr_malloc(sizeof(path_t));
+        if (path == NULL)
+            return;
+        neighbour->path_count++;
+        path->neighbour = neighbour;
+        path->route = route;
+        path->next = route->paths;
+        route->paths = path;
+        path->nbr_prev = NULL;
+        path->nbr_next = neighbour->paths;
+        if (neighbour->paths != NULL)
+            neighbour->paths->nbr_prev = path;
+        neighbour->paths = path;
+    }
+    path->metric = metric;
+    path->heard = neighbour->adverts;
+}
+
+// withdraws the paths the neighbour did not repeat in its current advertisement
+// (each one is its whole table); returns whether a route was lost
+static bool withdraw_unheard(dr_router_t *router, neighbour_t *neighbour, long now) {
+    bool lost = false;
+    path_t *path = neighbour->paths;
+    while (path != NULL) {
+        path_t *next = path->nbr_next;
+        if (path->heard != neighbour->adverts) {
+            route_t *route = path->route;
+            unlink_path(path);
+            if (route->via == neighbour && route->cost < INFINITY) {
+                uint32_t feasible = route->cost;
+                route->cost = INFINITY;
+                if (!fail_over(router, route, feasible, now))
+                    route->is_garbage = 1;
+                lost = true;
+            }
         }
+        path = next;
+    }
+    return lost;
+}
 
-        //Go through all directly connected subnets and adjust costs
-        unsigned int intcount = dr_interface_count();
-
-
-        //Create first routing table entries
-        for (unsigned int i = 0; i < intcount; i++) {
-            lvns_interface_t currInt = dr_get_interface(i);
-
-            if (currInt.enabled) {
-
-                node = head;
-                while (node != NULL) {
-                    if (((currInt.ip & currInt.subnet_mask) == (node->subnet & node->mask)) &&
-                        currInt.cost < node->cost) {
-                        node->next_hop_ip = 0;
-                        node->outgoing_intf = i;
-                        node->cost = currInt.cost;
-                        node->last_updated = -1;
-                        node->is_garbage = 0;
-                        send = true;
-                        printf("Special case set");
-                    }
-                    node = node->next;
-                }
+// sets quota[length] to how many of the entries with a prefix of that length may
+// be taken from a neighbour's advertisement: all of them, unless it advertises
+// more than max_neighbour_routes, in which case the shortest prefixes first
+static void neighbour_quota(dr_router_t *router, rip_entry_t **entries, unsigned count, unsigned quota[33]) {
+    for (unsigned length = 0; length <= 32; length++)
+        quota[length] = 0;
+    for (unsigned i = 0; i < count; i++)
+        if (entries[i]->metric < INFINITY)
+            quota[__builtin_popcount(entries[i]->subnet_mask)]++;
+
+    unsigned left = router->limits.max_neighbour_routes;
+    if (left == 0)
+        return;
+    for (unsigned length = 0; length <= 32; length++) {
+        if (quota[length] > left)
+            quota[length] = left;
+        left -= quota[length];
+    }
+}
 
+// makes room in a full table for a route with the mask: frees the unreachable
+// routes which nobody advertises and the listeners know as withdrawn, then,
+// under DR_OVERFLOW_PREFER_SHORT, the longest learned prefix longer than the
+// mask; returns whether there is room.  If *current is freed, it moves on to
+// the next route.
+static bool make_room(dr_router_t *router, uint32_t mask, route_t **current) {
+    unsigned max = router->limits.max_routes;
+    if (max == 0 || router->tablelength < max)
+        return true;
+
+    if (router->reclaimed_version != router->table_version) {
+        bool reclaimed = false;
+        route_t *r = router->head;
+        while (r != NULL) {
+            route_t *next = r->next;
+            if (r->via != NULL && r->cost >= INFINITY && r->paths == NULL && !r->announced) {
+                remove_route(router, r, current);
+                router->routes_reclaimed++;
+                reclaimed = true;
             }
+            r = next;
         }
+        if (reclaimed)
+            table_changed(router); /* it is no longer advertised */
+        router->reclaimed_version = router->table_version;
+        if (router->tablelength < max)
+            return true;
+    }
+
+    if (router->limits.policy != DR_OVERFLOW_PREFER_SHORT)
+        return false;
+    unsigned length = __builtin_popcount(mask);
+    if (router->no_victim_version == router->table_version && length >= router->no_victim_len)
+        return false;
+
+    route_t *victim = NULL;
+    unsigned victim_length = length;
+    for (route_t *r = router->head; r != NULL; r = r->next) {
+        if (r->via != NULL && (unsigned) __builtin_popcount(r->mask) > victim_length) {
+            victim = r;
+            victim_length = __builtin_popcount(r->mask);
+        }
+    }
+    if (victim == NULL) {
+        router->no_victim_version = router->table_version;
+        router->no_victim_len = length;
+        return false;
+    }
+
+    if (victim->announced)
+        notify_listeners(router, DR_ROUTE_WITHDRAW, victim);
+    remove_route(router, victim, current);
+    router->routes_evicted++;
+    table_changed(router);
+    router->reclaimed_version = router->table_version; /* nothing more to reclaim */
+    return true;
+}
+
+// unlinks the route from the table and frees it, together with the paths to it;
+// if it is *current, *current moves on to the next route
+static void remove_route(dr_router_t *router, route_t *route, route_t **current) {
+    if (*current == route)
+        *current = route->next;
+    while (route->paths != NULL)
+        unlink_path(route->paths);
+    intf_list_remove(router, route);
+    if (route->intf_subnet)
+        for (unsigned i = 0; i < router->intf_routes_size; i++)
+            if (router->subnet_routes[i] == route)
+                router->subnet_routes[i] = NULL;
+    if (route->previous != NULL)
+        route->previous->next = route->next;
+    else
+        router->head = route->next;
+    if (route->next != NULL)
+        route->next->previous = route->previous;
+    else
+        router->tail = route->previous;
+    router->tablelength--;
+    free(route);
+}
 
+// removes the path from its route and its neighbour, and frees it
+static void unlink_path(path_t *path) {
+    path_t **link = &path->route->paths;
+    while (*link != path)
+        link = &(*link)->next;
+    *link = path->next;
+
+    if (path->nbr_prev != NULL)
+        path->nbr_prev->nbr_next = path->nbr_next;
+    else
+        path->neighbour->paths = path->nbr_next;
+    if (path->nbr_next != NULL)
+        path->nbr_next->nbr_prev = path->nbr_prev;
+    path->neighbour->path_count--;
+    free(path);
+}
 
+// times out the routes learned from neighbours which fell silent, all of a
+// neighbour's routes at once, and forgets what it advertised once it has been
+// silent for the garbage interval as well; returns whether a route was lost
+static bool expire_neighbours(dr_router_t *router, long now) {
+    bool lost = false;
+
+    for (neighbour_t *n = router->neighbours; n != NULL; n = n->next) {
+        if (!n->expired && n->last_heard + RIP_TIMEOUT_SEC * 1000 < now) {
+            n->expired = true;
+            table_changed(router);
+            for (path_t *p = n->paths; p != NULL; p = p->nbr_next)
+                if (p->route->via == n && expire_route(router, p->route, now))
+                    lost = true;
+        }
+        if (n->last_heard + (RIP_TIMEOUT_SEC + RIP_GARBAGE_SEC) * 1000 < now) {
+            while (n->paths != NULL)
+                unlink_path(n->paths);
+        }
     }
+    return lost;
+}
 
-    //If not found in table then add
-    if (addEntry) {
-        route_t *node = (route_t *) malloc(sizeof(route_t));
-        makeroute_t(node, interfa.ip, interfa.subnet_mask, interfa.cost, intf, 0);
-        addLast(node);
-        send = true;
+// times out a route whose neighbour fell silent: falls back to a connected
+// interface or a loop-free alternate, or makes it unreachable; returns whether
+// it was lost rather than replaced by the interface
+static bool expire_route(dr_router_t *router, route_t *route, long now) {
+    if (route->cost >= INFINITY)
+        return false;
+
+    //Check if good way directly connected instead when timeout
+    int direct = connected_intf(router, route->subnet, route->mask);
+    if (direct >= 0 && router->intfs[direct].cost < 16) {
+        route->is_garbage = 0;
+        set_next_hop(router, route, direct, NULL);
+        route->cost = router->intfs[direct].cost;
+        return false;
     }
-    print_routing_table(head);
-    if (send) {
-        send_table();
+
+    uint32_t feasible = route->cost;
+    route->cost = 16;
+    if (!fail_over(router, route, feasible, now))
+        route->is_garbage = 1;
+    return true;
+}
+
+// routes the route over intf to the neighbour via (NULL if directly connected),
+// moving it to the list of routes of that interface
+static void set_next_hop(dr_router_t *router, route_t *route, unsigned intf, neighbour_t *via) {
+    if (route->outgoing_intf != intf) {
+        intf_list_remove(router, route);
+        route->outgoing_intf = intf;
+        intf_list_add(router, route);
     }
-    /*
-    if(garbageset)
-        clearup_table();
-    */
+    route->via = via;
+    route->next_hop_ip = via != NULL ? via->ip : 0;
+}
 
+// adds the route to the list of its interface; there is one for every interface
+// of the snapshot (see refresh_interfaces), so this never allocates
+static void intf_list_add(dr_router_t *router, route_t *route) {
+    unsigned intf = route->outgoing_intf;
+    route->intf_prev = NULL;
+    route->intf_next = router->intf_routes[intf];
+    if (route->intf_next != NULL)
+        route->intf_next->intf_prev = route;
+    router->intf_routes[intf] = route;
+}
 
+static void intf_list_remove(dr_router_t *router, route_t *route) {
+    if (route->intf_prev != NULL)
+        route->intf_prev->intf_next = route->intf_next;
+    else
+        router->intf_routes[route->outgoing_intf] = route->intf_next;
+    if (route->intf_next != NULL)
+        route->intf_next->intf_prev = route->intf_prev;
+    route->intf_next = route->intf_prev = NULL;
+}
 
+// returns the route to the (masked) subnet with the mask, or NULL
+static route_t *find_route(dr_router_t *router, uint32_t subnet, uint32_t mask) {
+    uint64_t key = prefix_key(subnet, mask);
+    for (route_t *r = router->head; r != NULL && prefix_key(r->subnet, r->mask) <= key; r = r->next)
+        if (r->subnet == subnet && r->mask == mask)
+            return r;
+    return NULL;
+}
 
+// returns the route to the subnet of the interface, or NULL; the table is only
+// searched if the route is not known yet (e.g. it was learned from a neighbour)
+// or the interface moved to another subnet
+static route_t *intf_subnet_route(dr_router_t *router, unsigned intf) {
+    lvns_interface_t i = get_intf(router, intf);
+    uint32_t subnet = i.ip & i.subnet_mask;
+    route_t *route = router->subnet_routes[intf];
+    if (route != NULL && route->subnet == subnet && route->mask == i.subnet_mask)
+        return route;
+
+    route = find_route(router, subnet, i.subnet_mask);
+    router->subnet_routes[intf] = route;
+    if (route != NULL)
+        route->intf_subnet = true;
+    return route;
+}
 
+// the cost of reaching the route over a path: INFINITY if its interface is down
+// or the neighbour did not repeat it in time
+static unsigned path_cost(dr_router_t *router, const path_t *path, long now) {
+    if (path->neighbour->last_heard + RIP_TIMEOUT_SEC * 1000 < now)
+        return INFINITY;
+    lvns_interface_t intf = get_intf(router, path->neighbour->intf);
+    if (!intf.enabled)
+        return INFINITY;
+    unsigned cost = path->metric + (intf.cost < INFINITY ? intf.cost : INFINITY);
+    return cost < INFINITY ? cost : INFINITY;
+}
 
+// switches the route to the cheapest loop-free alternate -- an interface on its
+// subnet, or a path over another neighbour whose metric is below feasible (the
+// cost we had before losing the route), so it cannot lead back through us --
+// if that is cheaper than the route's cost now; returns whether it did
+static bool fail_over(dr_router_t *router, route_t *route, uint32_t feasible, long now) {
+    const path_t *best = NULL;
+    unsigned best_cost = route->cost;
+    int direct = connected_intf(router, route->subnet, route->mask);
+
+    if (direct >= 0 && router->intfs[direct].cost < best_cost)
+        best_cost = router->intfs[direct].cost;
+    else
+        direct = -1;
+
+    for (const path_t *p = route->paths; p != NULL; p = p->next) {
+        if (p->metric >= feasible || p->neighbour == route->via)
+            continue;
+        unsigned cost = path_cost(router, p, now);
+        if (cost < best_cost) {
+            best = p;
+            best_cost = cost;
+        }
+    }
+    if (best == NULL && direct < 0)
+        return false;
+
+    if (best == NULL) {
+        route->cost = best_cost;
+        set_next_hop(router, route, direct, NULL);
+        route->is_garbage = 0;
+        return true;
+    }
 
+    route->cost = best_cost;
+    set_next_hop(router, route, best->neighbour->intf, best->neighbour);
+    route->is_garbage = 0;
+    return true;
 }
 
-/* definition of internal functions */
+// recomputes the best path of the route from the interfaces on its subnet and
+// the paths the neighbours advertised; returns whether the route changed
+static bool select_best(dr_router_t *router, route_t *route, long now) {
+    unsigned best_cost = INFINITY;
+    neighbour_t *best_via = route->via;
+    uint32_t best_intf = route->outgoing_intf;
+
+    int direct = connected_intf(router, route->subnet, route->mask);
+    if (direct >= 0 && router->intfs[direct].cost < best_cost) {
+        best_cost = router->intfs[direct].cost;
+        best_via = NULL;
+        best_intf = direct;
+    }
+
+    for (const path_t *p = route->paths; p != NULL; p = p->next) {
+        unsigned cost = path_cost(router, p, now);
+        bool current = p->neighbour == route->via;
+        if (cost < best_cost || (cost == best_cost && cost < INFINITY && current && best_via != NULL)) {
+            best_cost = cost;
+            best_via = p->neighbour;
+            best_intf = p->neighbour->intf;
+        }
+    }
+
+    if (best_cost >= INFINITY) {
+        if (route->cost >= INFINITY)
+            return false;
+        route->cost = INFINITY;
+        route->is_garbage = 1;
+        return true;
+    }
 
-// gives current time in milliseconds
-long get_time() {
-    // Now in milliseconds
-    struct timeval now;
-    gettimeofday(&now, NULL);
-    return now.tv_sec * 1000 + now.tv_usec / 1000;
+    bool changed = route->cost != best_cost || route->via != best_via || route->outgoing_intf != best_intf;
+    route->cost = best_cost;
+    set_next_hop(router, route, best_intf, best_via);
+    route->is_garbage = 0;
+    return changed;
+}
+
+// takes a new snapshot of the host's interfaces and indexes the enabled ones by
+// subnet; keeps the previous snapshot and returns -1 if out of memory
+static int refresh_interfaces(dr_router_t *router) {
+    unsigned count = router->host.interface_count(router->host.user);
+
+    //Every interface there has been gets a list of routes, so that adding a
+    //route to one never allocates
+    if (count > router->intf_routes_size) {
+        route_t **lists = (route_t **) dr_realloc(router->intf_routes, count * sizeof(route_t *));
+        if (lists == NULL)
+            return -1;
+        router->intf_routes = lists;
+        route_t **subnets = (route_t **) dr_realloc(router->subnet_routes, count * sizeof(route_t *));
+        if (subnets == NULL)
+            return -1;
+        router->subnet_routes = subnets;
+        unsigned added = count - router->intf_routes_size;
+        memset(lists + router->intf_routes_size, 0, added * sizeof(route_t *));
+        memset(subnets + router->intf_routes_size, 0, added * sizeof(route_t *));
+        router->intf_routes_size = count;
+    }
+
+    unsigned bits = 3;
+    while ((1u << bits) < 2 * count)
+        bits++;
+    lvns_interface_t *intfs = (lvns_interface_t *) dr_malloc((count + 1) * sizeof(lvns_interface_t));
+    connected_slot_t *connected = (connected_slot_t *) dr_malloc((1u << bits) * sizeof(connected_slot_t));
+    if (intfs == NULL || connected == NULL) {
+        free(intfs);
+        free(connected);
+        return -1;
+    }
+
+    for (unsigned i = 0; i < count; i++)
+        intfs[i] = router->host.get_interface(router->host.user, i);
+    for (unsigned s = 0; s < (1u << bits); s++)
+        connected[s].intf = -1;
+
+    unsigned shift = 32 - bits;
+    for (unsigned i = 0; i < count; i++) {
+        if (!intfs[i].enabled)
+            continue;
+        uint32_t subnet = intfs[i].ip & intfs[i].subnet_mask;
+        unsigned s = (subnet * 0x9E3779B1u) >> shift;
+        while (connected[s].intf >= 0 &&
+               (connected[s].subnet != subnet || connected[s].mask != intfs[i].subnet_mask))
+            s = (s + 1) & ((1u << bits) - 1);
+        //of several interfaces on one subnet, the cheapest one counts
+        if (connected[s].intf < 0 || intfs[i].cost < intfs[connected[s].intf].cost) {
+            connected[s].subnet = subnet;
+            connected[s].mask = intfs[i].subnet_mask;
+            connected[s].intf = i;
+        }
+    }
+
+    free(router->intfs);
+    free(router->connected);
+    router->intfs = intfs;
+    router->intf_total = count;
+    router->connected = connected;
+    router->connected_shift = shift;
+    return 0;
+}
+
+// returns the cheapest enabled interface on the (masked) subnet with the mask, or -1
+static int connected_intf(dr_router_t *router, uint32_t subnet, uint32_t mask) {
+    unsigned last = (1u << (32 - router->connected_shift)) - 1;
+    for (unsigned s = (subnet * 0x9E3779B1u) >> router->connected_shift;; s = (s + 1) & last) {
+        if (router->connected[s].intf < 0)
+            return -1;
+        if (router->connected[s].subnet == subnet && router->connected[s].mask == mask)
+            return router->connected[s].intf;
+    }
+}
+
+// interfaces beyond DR_STATS_MAX_INTF share the counters of the last one
+static dr_intf_stats_t *intf_stats(dr_router_t *router, unsigned intf) {
+    return &router->intf_stats[intf < DR_STATS_MAX_INTF ? intf : DR_STATS_MAX_INTF - 1];
+}
+
+// whether the call of an entry point which is starting is to be timed
+static bool timing_enabled(dr_router_t *router) {
+    return __atomic_load_n(&router->timed, __ATOMIC_RELAXED);
+}
+
+// the tick counter if the call is timed (else 0, without reading it)
+static uint64_t timing_ticks(bool timed) {
+    return timed ? dr_hist_ticks() : 0;
+}
+
+// records the timings of one call of an entry point: it asked for the lock at
+// start, got it at locked and returned from its safe_ function at done
+static void record_timing(dr_router_t *router, int op, uint64_t start, uint64_t locked, uint64_t done) {
+    dr_hist_record(&router->timing[op][PHASE_WAIT], locked - start);
+    dr_hist_record(&router->timing[op][PHASE_SAFE], done - locked);
+    dr_hist_record(&router->timing[op][PHASE_TOTAL], dr_hist_ticks() - start);
+}
+
+// takes a snapshot of the counters; the caller holds the coarse lock
+static void collect_stats(dr_router_t *router, dr_stats_t *stats) {
+    memset(stats, 0, sizeof(dr_stats_t));
+    dr_stats_sum_lookups(&router->lookups, stats);
+
+    for (route_t *r = router->head; r != NULL; r = r->next) {
+        stats->routes++;
+        if (r->is_garbage)
+            stats->garbage++;
+    }
+    unsigned neighbours = 0;
+    size_t adverts = 0;   /* the copies of their advertisements */
+    for (neighbour_t *n = router->neighbours; n != NULL; n = n->next) {
+        neighbours++;
+        stats->paths += n->path_count;
+        adverts += n->deferred_size + n->last_size;
+    }
+
+    stats->rib_bytes = sizeof(dr_router_t) + stats->routes * sizeof(route_t) + stats->paths * sizeof(path_t) +
+                       neighbours * sizeof(neighbour_t) + adverts + (router->intf_total + 1) * sizeof(lvns_interface_t) +
+                       ((size_t) 1 << (32 - router->connected_shift)) * sizeof(connected_slot_t) +
+                       2 * router->intf_routes_size * sizeof(route_t *) + router->summaries_size * sizeof(uint64_t) +
+                       router->sorted_entries_size * sizeof(rip_entry_t *) +
+                       router->payload_size * sizeof(rip_entry_t) + router->listener_count * sizeof(route_listener_t);
+    stats->fib_bytes = fib_memory(router->fib) + router->fib_entries_size * sizeof(fib_entry_t);
+    stats->memory_bytes = stats->rib_bytes + stats->fib_bytes;
+    stats->routes_evicted = router->routes_evicted;
+    stats->routes_reclaimed = router->routes_reclaimed;
+    stats->pcap_dropped = router->pcap != NULL ? dr_pcap_dropped(router->pcap) : 0;
+
+    unsigned count = intf_count(router);
+    stats->intf_count = count < DR_STATS_MAX_INTF ? count : DR_STATS_MAX_INTF;
+    memcpy(stats->intf, router->intf_stats, stats->intf_count * sizeof(dr_intf_stats_t));
+    for (unsigned i = 0; i < stats->intf_count; i++)
+        stats->routes_rejected += stats->intf[i].routes_rejected;
+}
+
+// checks that an advertised entry has a metric of at most INFINITY and a
+// contiguous subnet mask
+static bool valid_entry(const rip_entry_t *entry) {
+    uint32_t inverse = ~ntohl(entry->subnet_mask);
+    return entry->metric <= INFINITY && (inverse & (inverse + 1)) == 0;
+}
+
+static uint64_t entry_key(const rip_entry_t *entry) {
+    return prefix_key(entry->ip & entry->subnet_mask, entry->subnet_mask);
+}
+
+// orders entries by prefix, and those for the same prefix as in the packet
+static int cmp_entry(const void *a, const void *b) {
+    const rip_entry_t *x = *(rip_entry_t *const *) a, *y = *(rip_entry_t *const *) b;
+    uint64_t kx = entry_key(x), ky = entry_key(y);
+    if (kx != ky)
+        return kx < ky ? -1 : 1;
+    return x < y ? -1 : x > y;
+}
+
+// fills router->sorted_entries with the valid entries of the payload, sorted by
+// prefix; returns how many there are (-1 if out of memory)
+static int sort_entries(dr_router_t *router, rip_entry_t *payload, unsigned count) {
+    if (count > router->sorted_entries_size) {
+        rip_entry_t **grown = (rip_entry_t **) dr_realloc(router->sorted_entries, count * sizeof(rip_entry_t *));
+        if (grown == NULL)
+            return -1;
+        router->sorted_entries = grown;
+        router->sorted_entries_size = count;
+    }
+
+    //Skip entries no well-behaved neighbour can have sent
+    unsigned n = 0;
+    bool in_order = true;
+    for (unsigned i = 0; i < count; i++) {
+        if (!valid_entry(&payload[i]))
+            continue;
+        if (n > 0 && entry_key(router->sorted_entries[n - 1]) > entry_key(&payload[i]))
+            in_order = false;
+        router->sorted_entries[n++] = &payload[i];
+    }
+
+    //Routers running this code advertise their table in order already
+    if (!in_order)
+        qsort(router->sorted_entries, n, sizeof(rip_entry_t *), cmp_entry);
+    return n;
+}
+
+#ifdef DR_CHECK_INVARIANTS
+// asserts that the list is well-formed and sorted by prefix (so no prefix is in
+// it twice), that no cost exceeds INFINITY and that lookups agree with a scan of
+// the table
+static void check_table(dr_router_t *router) {
+    unsigned n = 0;
+    route_t *previous = NULL;
+
+    for (route_t *r = router->head; r != NULL; r = r->next) {
+        assert(n < router->tablelength);
+        assert(r->previous == previous);
+        assert(r->cost <= INFINITY);
+        assert((r->subnet & r->mask) == r->subnet);
+        assert(previous == NULL ||
+               prefix_key(previous->subnet, previous->mask) < prefix_key(r->subnet, r->mask));
+        assert(r->via == NULL ? r->next_hop_ip == 0
+                              : r->next_hop_ip == r->via->ip && r->outgoing_intf == r->via->intf);
+        previous = r;
+        n++;
+    }
+    assert(n == router->tablelength);
+    assert(router->tail == previous);
+
+    unsigned listed = 0;
+    for (unsigned i = 0; i < router->intf_routes_size; i++)
+        for (route_t *r = router->intf_routes[i]; r != NULL; r = r->intf_next) {
+            assert(r->outgoing_intf == i);
+            assert(r->intf_next == NULL || r->intf_next->intf_prev == r);
+            listed++;
+        }
+    assert(listed == n);
+    for (unsigned i = 0; i < router->intf_routes_size; i++)
+        assert(router->subnet_routes[i] == NULL || router->subnet_routes[i]->intf_subnet);
+
+    for (neighbour_t *nb = router->neighbours; nb != NULL; nb = nb->next) {
+        unsigned paths = 0;
+        for (path_t *p = nb->paths; p != NULL; p = p->nbr_next) {
+            assert(p->neighbour == nb);
+            assert(p->nbr_next == NULL || p->nbr_next->nbr_prev == p);
+            assert(p->metric < INFINITY);
+            paths++;
+        }
+        assert(paths == nb->path_count);
+    }
+
+    for (route_t *r = router->head; r != NULL; r = r->next) {
+        uint32_t ip = r->subnet | (~r->mask & htonl(1));
+        route_t *best = NULL;
+        for (route_t *m = router->head; m != NULL; m = m->next)
+            if ((ip & m->mask) == m->subnet && m->cost < INFINITY &&
+                (best == NULL || ntohl(m->mask) > ntohl(best->mask)))
+                best = m;
+
+        next_hop_t hop = safe_dr_get_next_hop(router, ip);
+        assert(best == NULL ? hop.dst_ip == 0xFFFFFFFF
+                            : hop.dst_ip == best->next_hop_ip && hop.interface == best->outgoing_intf);
+    }
 }
+#endif
 
 // prints an ip address in the correct format
 // this function is taken from: 
@@ -831,29 +2452,30 @@ void print_ip(int ip) {
     bytes[1] = (ip >> 8) & 0xFF;
     bytes[2] = (ip >> 16) & 0xFF;
     bytes[3] = (ip >> 24) & 0xFF;
-    printf("%d.%d.%d.%d\n", bytes[3], bytes[2], bytes[1], bytes[0]);
+    DR_TRACE("%d.%d.%d.%d\n", bytes[3], bytes[2], bytes[1], bytes[0]);
 }
 
 // prints the full routing table
 void print_routing_table(route_t *head) {
-    printf("==================================================================\nROUTING TABLE:\n==================================================================\n");
+    DR_TRACE("==================================================================\nROUTING TABLE:\n==================================================================\n");
     int counter = 0;
     route_t *current = head;
     while (current != NULL) {
-        printf("Entry %d:\n", counter);
-        printf("\tSubnet: ");
+        DR_TRACE("Entry %d:\n", counter);
+        DR_TRACE("\tSubnet: ");
         print_ip(htonl(current->subnet));
-        printf("\tMask: ");
+        DR_TRACE("\tMask: ");
         print_ip(htonl(current->mask));
-        printf("\tNext hop ip: ");
+        DR_TRACE("\tNext hop ip: ");
         print_ip(htonl(current->next_hop_ip));
-        printf("\tOutgoing interface: ");
+        DR_TRACE("\tOutgoing interface: ");
         print_ip(htonl(current->outgoing_intf));
-        printf("\tCost: %d\n", current->cost);
-        printf("\tLast updated (timestamp in microseconds): %li \n", current->last_updated);
-        printf("\tGarbage: %d\n", current->is_garbage);
+        DR_TRACE("\tCost: %d\n", current->cost);
+        DR_TRACE("\tLast heard (timestamp in milliseconds): %li \n",
+                 current->via != NULL ? current->via->last_heard : -1);
+        DR_TRACE("\tGarbage: %d\n", current->is_garbage);
 
-        printf("==============================\n");
+        DR_TRACE("==============================\n");
         counter++;
 
         current = current->next;
@@ -861,26 +2483,26 @@ void print_routing_table(route_t *head) {
 }
 
 void print_rippacket(uint32_t ip, unsigned intf, rip_entry_t *paket, int nrofentries) {
-    printf("==================================================================\nPackets:\n==================================================================\n");
-    printf("Incomming IP: ");
+    DR_TRACE("==================================================================\nPackets:\n==================================================================\n");
+    DR_TRACE("Incomming IP: ");
     print_ip(htonl(ip));
-    printf("Incomming Interface Nr: ");
+    DR_TRACE("Incomming Interface Nr: ");
     print_ip(htonl(intf));
-    printf("\n");
+    DR_TRACE("\n");
 
     rip_entry_t *entry = paket;
     int counter = 0;
 
     for (int i = 0; i < nrofentries; i++) {
 
-        printf("Entry %d:\n", counter);
-        printf("Packet IP: ");
+        DR_TRACE("Entry %d:\n", counter);
+        DR_TRACE("Packet IP: ");
         print_ip(htonl(entry->ip));
-        printf("Packet Mask: ");
+        DR_TRACE("Packet Mask: ");
         print_ip(htonl(entry->subnet_mask));
-        printf("Packet NextHop IP: ");
+        DR_TRACE("Packet NextHop IP: ");
         print_ip(htonl(entry->next_hop));
-        printf("Packet Matric: %d\n\n", entry->metric);
+        DR_TRACE("Packet Matric: %d\n\n", entry->metric);
         counter++;
 
         entry++;
@@ -10,7 +10,9 @@
 #ifdef _LINUX_
 #include <stdint.h>
 #endif
+#include <stdio.h>
 
+#include "dr_stats.h"
 #include "lvns_types.h"
 
 /**
@@ -66,7 +68,8 @@ void dr_handle_periodic();
 
 /**
  * This method is called when an interface is brought up or down and/or if its
- * cost is changed.
+ * cost is changed.  The library works from a snapshot of the interfaces which
+ * is only refreshed here, so it must be called for every such change.
  *
  * @param intf             the index of the interface whose state has changed
  * @param state_changed    boolean; non-zero if the intf was brought up or down
@@ -74,8 +77,262 @@ void dr_handle_periodic();
  */
 void dr_interface_changed(unsigned intf, int state_changed, int cost_changed);
 
+/**
+ * Fills stats with a snapshot of the counters of the router (see dr_stats.h).
+ * This is cheap enough to be polled, unlike the tracing of debug builds.
+ */
+void dr_get_stats(dr_stats_t* stats);
+
+/**
+ * Additionally exports the counters to the POSIX shared memory object shm_name
+ * (e.g. "/dr-stats"), laid out as a dr_stats_page_t and refreshed on every
+ * periodic callback.  Returns 0 on success and -1 otherwise.
+ */
+int dr_export_stats(const char* shm_name);
+
+/**
+ * Writes the latency of each entry point to out, one JSON object per line and
+ * per phase: "wait" (for the lock), "safe" (the work done holding it) and
+ * "total".  Each has the count, the 50th/90th/99th/99.9th percentiles and the
+ * maximum in nanoseconds, of the calls made while timing was enabled (see
+ * dr_set_timing).  The first call takes a few milliseconds to calibrate the
+ * time stamp counter.
+ */
+void dr_dump_timing(FILE* out);
+
+/**
+ * Enables (or disables) timing the entry points for dr_dump_timing.  It is off
+ * by default: the histograms are shared by all threads, so every timed call
+ * updates a few contended cache lines.
+ */
+void dr_set_timing(int enabled);
+
+/** how a usable route (one with a cost below infinity) changed */
+typedef enum dr_route_event_t {
+    DR_ROUTE_ADD,       /* the prefix became reachable                     */
+    DR_ROUTE_MODIFY,    /* its next hop, interface or cost changed         */
+    DR_ROUTE_WITHDRAW   /* it is no longer reachable (route holds the last
+                           announced next hop and cost)                   */
+} dr_route_event_t;
+
+/** a route as announced to route listeners (prefix and mask in network-byte order) */
+typedef struct dr_route_t {
+    uint32_t prefix;
+    uint32_t mask;
+    next_hop_t hop;
+    unsigned cost;
+} dr_route_t;
+
+typedef void (*dr_route_listener_t)(void* user, dr_route_event_t event,
+                                    const dr_route_t* route);
+
+/**
+ * Registers fn to be told about every change of the usable routes, so that e.g.
+ * a separate forwarding plane can keep its table in sync incrementally.  fn is
+ * first called with DR_ROUTE_ADD for each route which is already usable.
+ *
+ * The changes made by one call into the library are announced together just
+ * before it returns, on the thread which made the call and while holding the
+ * library's lock: fn must be quick and may only call dr_get_next_hop or
+ * dr_get_stats.  Returns 0 on success and -1 if out of memory.
+ */
+int dr_subscribe_routes(dr_route_listener_t fn, void* user);
+
+/** Stops calling fn (with this user pointer) about route changes. */
+void dr_unsubscribe_routes(dr_route_listener_t fn, void* user);
+
+/**
+ * Enables (non-zero) or disables (0, the default) aggregation of the routes
+ * advertised: two sibling prefixes (e.g. 10.0.0.0/25 and 10.0.0.128/25) which
+ * are advertised on an interface with the same metric and next hop are
+ * replaced by the prefix covering both (10.0.0.0/24), repeatedly, unless that
+ * prefix is in the table itself.  Only whole prefixes are merged, so no
+ * destination becomes reachable which was not, and the routes of the table are
+ * all advertised, even those within a summary heard from a neighbour.  While
+ * route limits are set (dr_set_route_limits), only the directly connected
+ * routes are merged: which learned routes a router holds then depends on what
+ * its neighbours advertise, and summaries of them would feed back into that.
+ */
+void dr_set_aggregation(int enabled);
+
+/**
+ * Enables (non-zero) or disables (0, the default) compression of the forwarding
+ * table: before the usable routes are loaded into it, they are replaced by the
+ * smallest set of prefixes which forwards every address the same way (see
+ * fib_compress in dr_fib.h).  The routing table, and so what is advertised and
+ * told to the route listeners, stays as it is.  The forwarding table is rebuilt
+ * by the call which changed the routes, never by dr_get_next_hop, so lookups do
+ * not wait for the compression.
+ */
+void dr_set_fib_compression(int enabled);
+
+/** what becomes of a route learned beyond one of the limits of dr_route_limits_t */
+typedef enum dr_overflow_policy_t {
+    DR_OVERFLOW_REJECT,         /* it is refused                               */
+    DR_OVERFLOW_PREFER_SHORT    /* it displaces a longer prefix (e.g. a /24 a
+                                   /30), and is refused if there is none       */
+} dr_overflow_policy_t;
+
+/** bounds on how much the neighbours can make a router store (0: no limit) */
+typedef struct dr_route_limits_t {
+    unsigned max_routes;            /* routes in the table, directly connected
+                                       ones included (those are never refused) */
+    unsigned max_neighbour_routes;  /* routes taken from one neighbour          */
+    dr_overflow_policy_t policy;    /* once the table holds max_routes          */
+} dr_route_limits_t;
+
+/**
+ * Limits how many routes the neighbours can make the router learn, and so its
+ * memory and the size of its forwarding table.  Of an advertisement at most
+ * max_neighbour_routes routes are taken, the shortest prefixes first; the rest
+ * are treated as if they were not advertised.  Once the table holds
+ * max_routes, the unreachable routes nobody advertises any more are freed to
+ * make room, and beyond that a new route is refused or, with
+ * DR_OVERFLOW_PREFER_SHORT, replaces the longest learned prefix which is longer
+ * than its own.  See routes_rejected, routes_evicted and routes_reclaimed in
+ * dr_stats_t.  By default there are no limits; lowering max_routes does not
+ * remove routes which are in the table already.
+ */
+void dr_set_route_limits(const dr_route_limits_t* limits);
+
+/** what becomes of an advertisement beyond the rate limit */
+typedef enum dr_rate_policy_t {
+    DR_RATE_DROP,       /* it is ignored                                       */
+    DR_RATE_DEFER       /* it is merged once the neighbour has a token again,
+                           unless a later advertisement replaced it by then    */
+} dr_rate_policy_t;
+
+/** a token bucket per neighbour (each source IP on each interface) */
+typedef struct dr_rate_limit_t {
+    unsigned rate;      /* advertisements per second (0: no limit)             */
+    unsigned burst;     /* how many may come at once (at least 1)              */
+    dr_rate_policy_t policy;
+} dr_rate_limit_t;
+
+/**
+ * Limits how fast each neighbour may make the router merge its advertisements,
+ * so that a neighbour stuck in a flapping loop cannot keep it busy (and hold
+ * its lock, delaying dr_get_next_hop).  The bucket is checked before the
+ * payload is looked at; an advertisement beyond it still shows the neighbour
+ * is alive.  Deferred advertisements are merged by the periodic callback.  See
+ * adverts_deferred and adverts_dropped in dr_stats_t.  By default there is no
+ * limit.
+ */
+void dr_set_rate_limit(const dr_rate_limit_t* limit);
+
+/**
+ * Starts recording every call into the library but dr_get_next_hop, with its
+ * time, payload and the interfaces it saw, to the capture file at path (see
+ * dr_capture.h), or stops if path is NULL.  dr_replay can then drive a fresh
+ * router the same way, e.g. to reproduce how the router converged.  What the
+ * router learned before the capture started is not in it, so to reproduce it
+ * exactly start right after creating it: dr_init does so itself if the
+ * environment variable DR_CAPTURE names a file.  Records are buffered, so they
+ * only reach the file in large blocks and when the capture stops.  Returns 0 on
+ * success and -1 if the file cannot be created.
+ */
+int dr_capture(const char* path);
+
+/**
+ * Starts writing every advertisement the router sends or receives to the pcap
+ * file at path, or stops if path is NULL.  Each is wrapped in the IPv4, UDP
+ * (port 520) and RIPv2 headers it would have on the wire, from the interface
+ * or neighbour to RIP_IP (224.0.0.9), so tools like Wireshark and tshark can
+ * analyse the traffic (see dr_pcap.h).  The packets are only copied on the
+ * protocol path and written by a thread of their own; if it falls behind they
+ * are dropped, see pcap_dropped in dr_stats_t.  dr_init starts the export
+ * itself if the environment variable DR_PCAP names a file.  Returns 0 on
+ * success and -1 if the file cannot be created.
+ */
+int dr_export_pcap(const char* path);
+
+
+/*
+ * Router contexts.  The functions above serve a single router per process.  The
+ * ones below do the same for any number of routers, each with its own routing
+ * table and lock, which e.g. lets one process emulate a whole network.  The
+ * legacy functions are a thin layer over a router created by dr_init.
+ */
+
+/** the state of one router */
+typedef struct dr_router_t dr_router_t;
+
+/**
+ * How a router reaches its host.  The functions have the same meaning as those
+ * passed to dr_init, except that each also gets the user pointer back.
+ */
+typedef struct dr_host_t {
+    unsigned (*interface_count)(void* user);
+    lvns_interface_t (*get_interface)(void* user, unsigned index);
+    void (*send_payload)(void* user,
+                         uint32_t dst_ip,
+                         uint32_t next_hop_ip,
+                         uint32_t outgoing_intf,
+                         char* /* borrowed */,
+                         unsigned);
+    void* user;
+} dr_host_t;
+
+/**
+ * Creates a router (the host is copied).  Unless the virtual clock is in use
+ * (see dr_clock.h), a thread shared by all routers calls
+ * dr_router_handle_periodic on it at a regular interval.  Returns NULL if out
+ * of memory.
+ */
+dr_router_t* dr_router_create(const dr_host_t* host);
+
+/** Frees the router.  No other call on it may be in progress or follow. */
+void dr_router_destroy(dr_router_t* router);
+
+/** Like dr_get_next_hop, for the specified router. */
+next_hop_t dr_router_get_next_hop(dr_router_t* router, uint32_t ip);
+
+/** Like dr_handle_packet, for the specified router. */
+void dr_router_handle_packet(dr_router_t* router, uint32_t ip, unsigned intf,
+                             char* buf /* borrowed */, unsigned len);
+
+/** Like dr_handle_periodic, for the specified router. */
+void dr_router_handle_periodic(dr_router_t* router);
+
+/** Like dr_interface_changed, for the specified router. */
+void dr_router_interface_changed(dr_router_t* router, unsigned intf,
+                                 int state_changed, int cost_changed);
+
+/** Like dr_get_stats, for the specified router. */
+void dr_router_get_stats(dr_router_t* router, dr_stats_t* stats);
+
+/** Like dr_export_stats, for the specified router. */
+int dr_router_export_stats(dr_router_t* router, const char* shm_name);
+
+/** Like dr_dump_timing, for the specified router. */
+void dr_router_dump_timing(dr_router_t* router, FILE* out);
+
+/** Like dr_set_timing, for the specified router. */
+void dr_router_set_timing(dr_router_t* router, int enabled);
+
+/** Like dr_subscribe_routes, for the specified router. */
+int dr_router_subscribe_routes(dr_router_t* router, dr_route_listener_t fn, void* user);
+
+/** Like dr_unsubscribe_routes, for the specified router. */
+void dr_router_unsubscribe_routes(dr_router_t* router, dr_route_listener_t fn, void* user);
+
+/** Like dr_set_aggregation, for the specified router. */
+void dr_router_set_aggregation(dr_router_t* router, int enabled);
+
+/** Like dr_set_fib_compression, for the specified router. */
+void dr_router_set_fib_compression(dr_router_t* router, int enabled);
+
+/** Like dr_set_route_limits, for the specified router. */
+void dr_router_set_route_limits(dr_router_t* router, const dr_route_limits_t* limits);
+
+/** Like dr_set_rate_limit, for the specified router. */
+void dr_router_set_rate_limit(dr_router_t* router, const dr_rate_limit_t* limit);
 
+/** Like dr_capture, for the specified router. */
+int dr_router_capture(dr_router_t* router, const char* path);
 
+/** Like dr_export_pcap, for the specified router. */
+int dr_router_export_pcap(dr_router_t* router, const char* path);
 
 
 #endif /* _DR_API_H_ */
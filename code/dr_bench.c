@@ -0,0 +1,733 @@
+/*
+ * Filename: dr_bench.c
+ * Purpose:  Convergence benchmark for the Dynamic Routing library.
+ *
+ * Every router of a .topo file is a router context of the library (see
+ * dr_router_create) running on the virtual clock, and the links are simulated
+ * in-process (zero delay, no loss).
+ * After the initial convergence a list of events is applied one at a time:
+ *
+ *   link del IP1 IP2          -- take a link down (both ends see it)
+ *   cost set link IP1 IP2 C   -- set the cost of both ends of a link to C
+ *   node fail NAME            -- the router silently stops (neighbours time out)
+ *
+ * The events are read from the file given with -e, otherwise a link deletion,
+ * a cost change and a node failure are picked from the middle of the topology.
+ * For each event one JSON object is written per line:
+ *
+ *   topology, routers, links, event, convergence_ms (virtual time until the
+ *   last change of any advertised table), converged (whether the network then
+ *   stayed quiet, within 15 virtual minutes; dr_bench exits with status 1 if a
+ *   phase did not), messages and bytes (sent until then),
+ *   peak_advert (most entries in a single advertisement), max_routes (the
+ *   largest routing table of any router at the end, see dr_get_stats) and
+ *   wall_ms.  The tracing of debug builds goes to stderr, so stdout only has
+ *   the results.
+ *
+ * With -a every router aggregates the routes it advertises (see
+ * dr_set_aggregation).
+ *
+ * With -l ROUTES[:PER_NEIGHBOUR[:short]] every router limits the routes it
+ * learns (see dr_set_route_limits; "short" selects DR_OVERFLOW_PREFER_SHORT),
+ * and each phase also reports the largest routing memory of any router
+ * (max_bytes) and the sums of routes_rejected,
+ * routes_evicted and routes_reclaimed.
+ *
+ * With -r RATE[:BURST[:defer]] every router limits how many advertisements per
+ * second it merges from each neighbour (see dr_set_rate_limit; "defer" selects
+ * DR_RATE_DEFER), and each phase also reports the sums of adverts_deferred and
+ * adverts_dropped.
+ *
+ * With -c ROUTER:FILE the calls into the router named ROUTER are recorded to
+ * the capture file FILE (see dr_capture), for dr_replay, and with -p ROUTER:FILE
+ * the advertisements it sends and receives are written to the pcap file FILE
+ * (see dr_export_pcap).  The packets are time stamped with the virtual clock.
+ *
+ * With -s PERIODS each phase is followed by that many more advertisement
+ * intervals in which every router also looks up every interface address, and
+ * steady_allocs reports how often the library allocated memory meanwhile.  That
+ * should be never; dr_bench exits with status 1 if it was not.
+ *
+ * Usage: dr_bench [-a] [-c ROUTER:FILE] [-p ROUTER:FILE] [-l LIMITS] [-r RATE] [-s PERIODS] [-e EVENTS] [-o OUTPUT] TOPO...
+ */
+
+#include <arpa/inet.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "dr_alloc.h"
+#include "dr_api.h"
+#include "dr_clock.h"
+
+/** size of a single entry in a RIP advertisement */
+#define BENCH_RIP_ENTRY_SIZE 20
+
+/** the periodic callbacks are made once per (virtual) second */
+#define BENCH_TICK_MS 1000
+
+/** how often the routers advertise their tables (RIP_ADVERT_INTERVAL_SEC) */
+#define BENCH_ADVERT_MS 10000
+
+/** a phase is over once no advertised table changed for this long ... */
+#define BENCH_QUIET_MS 40000
+
+/** ... or when this much virtual time has passed */
+#define BENCH_MAX_PHASE_MS 900000
+
+#define BENCH_MAX_LINE 4096
+
+/** an interface of a simulated node */
+typedef struct bench_intf_t {
+    lvns_interface_t info;
+    int peer_node;          /* node at the other end of the link, -1 if none */
+    unsigned peer_intf;     /* index of the interface on the peer node */
+    uint64_t last_advert;   /* fingerprint of the last advertisement sent */
+} bench_intf_t;
+
+/** a simulated node; only nodes of type "dr" run the library */
+typedef struct bench_node_t {
+    char name[64];
+    int is_router;
+    int alive;
+
+    bench_intf_t *intfs;
+    unsigned intf_count;
+    unsigned intf_capacity;
+
+    dr_router_t *router;
+} bench_node_t;
+
+/** a link as listed in the topology file */
+typedef struct bench_link_t {
+    uint32_t ip[2];
+} bench_link_t;
+
+/** a packet which is waiting to be delivered */
+typedef struct bench_msg_t {
+    int node;
+    unsigned intf;
+    uint32_t src_ip;
+    char *buf;
+    unsigned len;
+} bench_msg_t;
+
+/** counters for the phase which is currently being measured */
+typedef struct bench_phase_t {
+    long start_ms;
+    long last_change_ms;
+    unsigned long messages;
+    unsigned long bytes;
+    unsigned long messages_at_change;
+    unsigned long bytes_at_change;
+    unsigned peak_advert;
+} bench_phase_t;
+
+/* the simulation */
+static bench_node_t *nodes;
+static unsigned node_count;
+static bench_link_t *links;
+static unsigned link_count;
+static int aggregate;
+static int limited;
+static dr_route_limits_t limits;
+static int rate_limited;
+static dr_rate_limit_t rate_limit;
+static const char *capture_router;
+static const char *capture_path;
+static const char *pcap_router;
+static const char *pcap_path;
+static unsigned steady_periods;
+static int steady_allocated;    /* whether the library allocated in a steady state */
+static int unconverged;         /* whether a phase did not converge */
+
+static bench_msg_t *queue;
+static unsigned queue_head;
+static unsigned queue_tail;
+static unsigned queue_capacity;
+
+static long now_ms;
+static bench_phase_t phase;
+
+static void die(const char *msg, const char *arg) {
+    fprintf(stderr, "dr_bench: %s%s%s\n", msg, arg ? ": " : "", arg ? arg : "");
+    exit(1);
+}
+
+static void *xrealloc(void *p, size_t size) {
+    p = realloc(p, size);
+    if (p == NULL)
+        die("out of memory", NULL);
+    return p;
+}
+
+static double wall_ms() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000.0 + ts.tv_nsec / 1000000.0;
+}
+
+/** 64-bit FNV-1a; only used to notice that an advertisement changed */
+static uint64_t fingerprint(const char *buf, unsigned len) {
+    uint64_t h = 14695981039346656037ULL;
+    for (unsigned i = 0; i < len; i++) {
+        h ^= (unsigned char) buf[i];
+        h *= 1099511628211ULL;
+    }
+    return h;
+}
+
+/* ****************************** topology ****************************** */
+
+static bench_node_t *find_or_add_node(const char *name) {
+    for (unsigned i = 0; i < node_count; i++)
+        if (strcmp(nodes[i].name, name) == 0)
+            return &nodes[i];
+
+    nodes = (bench_node_t *) xrealloc(nodes, (node_count + 1) * sizeof(bench_node_t));
+    bench_node_t *node = &nodes[node_count++];
+    memset(node, 0, sizeof(bench_node_t));
+    snprintf(node->name, sizeof(node->name), "%s", name);
+    node->alive = 1;
+    return node;
+}
+
+/** parses "a.b.c.d/len[:cost]" and appends it as an interface of node */
+static void add_interface(bench_node_t *node, const char *spec) {
+    char addr[64];
+    unsigned len = 32, cost = 1;
+
+    const char *slash = strchr(spec, '/');
+    size_t n = slash ? (size_t) (slash - spec) : strlen(spec);
+    if (n >= sizeof(addr))
+        die("bad interface", spec);
+    memcpy(addr, spec, n);
+    addr[n] = '\0';
+    if (slash && sscanf(slash + 1, "%u:%u", &len, &cost) < 1)
+        die("bad interface", spec);
+    if (len > 32)
+        die("bad prefix length", spec);
+
+    if (node->intf_count == node->intf_capacity) {
+        node->intf_capacity = node->intf_capacity ? 2 * node->intf_capacity : 4;
+        node->intfs = (bench_intf_t *) xrealloc(node->intfs, node->intf_capacity * sizeof(bench_intf_t));
+    }
+    bench_intf_t *intf = &node->intfs[node->intf_count++];
+    memset(intf, 0, sizeof(bench_intf_t));
+    if (inet_pton(AF_INET, addr, &intf->info.ip) != 1)
+        die("bad interface address", spec);
+    intf->info.subnet_mask = len ? htonl(0xFFFFFFFFu << (32 - len)) : 0;
+    intf->info.enabled = 1;
+    intf->info.cost = cost;
+    intf->peer_node = -1;
+}
+
+/** an interface address, for looking up interfaces by address */
+typedef struct bench_addr_t {
+    uint32_t ip;
+    int node;
+    unsigned intf;
+} bench_addr_t;
+
+static bench_addr_t *addrs;
+static unsigned addr_count;
+
+static int cmp_addr(const void *a, const void *b) {
+    uint32_t x = ((const bench_addr_t *) a)->ip, y = ((const bench_addr_t *) b)->ip;
+    return x < y ? -1 : x > y;
+}
+
+/** indexes the interface addresses of every node */
+static void index_interfaces() {
+    addr_count = 0;
+    for (unsigned i = 0; i < node_count; i++)
+        addr_count += nodes[i].intf_count;
+    addrs = (bench_addr_t *) xrealloc(addrs, (addr_count + 1) * sizeof(bench_addr_t));
+
+    unsigned k = 0;
+    for (unsigned i = 0; i < node_count; i++)
+        for (unsigned j = 0; j < nodes[i].intf_count; j++) {
+            addrs[k].ip = nodes[i].intfs[j].info.ip;
+            addrs[k].node = i;
+            addrs[k++].intf = j;
+        }
+    qsort(addrs, addr_count, sizeof(bench_addr_t), cmp_addr);
+}
+
+/** finds the interface with the given address */
+static int find_interface(uint32_t ip, int *node, unsigned *intf) {
+    bench_addr_t key;
+    key.ip = ip;
+    bench_addr_t *found = (bench_addr_t *) bsearch(&key, addrs, addr_count, sizeof(bench_addr_t), cmp_addr);
+    if (found == NULL)
+        return 0;
+    *node = found->node;
+    *intf = found->intf;
+    return 1;
+}
+
+static void load_topology(const char *path) {
+    char line[BENCH_MAX_LINE];
+    FILE *f = fopen(path, "r");
+    if (f == NULL)
+        die("cannot open topology", path);
+
+    while (fgets(line, sizeof(line), f)) {
+        char *argv[64];
+        int argc = 0;
+        for (char *tok = strtok(line, " \t\r\n"); tok && argc < 64; tok = strtok(NULL, " \t\r\n"))
+            argv[argc++] = tok;
+        if (argc == 0 || argv[0][0] == '#')
+            continue;
+
+        if (argc >= 4 && !strcmp(argv[0], "node") && !strcmp(argv[1], "add")) {
+            bench_node_t *node = find_or_add_node(argv[2]);
+            node->is_router = !strcmp(argv[3], "dr");
+            for (int i = 4; i < argc; i++)
+                add_interface(node, argv[i]);
+        } else if (argc >= 4 && !strcmp(argv[0], "link") && !strcmp(argv[1], "add")) {
+            links = (bench_link_t *) xrealloc(links, (link_count + 1) * sizeof(bench_link_t));
+            if (inet_pton(AF_INET, argv[2], &links[link_count].ip[0]) != 1 ||
+                inet_pton(AF_INET, argv[3], &links[link_count].ip[1]) != 1)
+                die("bad link", argv[2]);
+            link_count++;
+        }
+    }
+    fclose(f);
+
+    /* plumb the links together once every node is known */
+    index_interfaces();
+    for (unsigned i = 0; i < link_count; i++) {
+        int n0, n1;
+        unsigned i0, i1;
+        if (!find_interface(links[i].ip[0], &n0, &i0) || !find_interface(links[i].ip[1], &n1, &i1))
+            die("link to an unknown interface in", path);
+        nodes[n0].intfs[i0].peer_node = n1;
+        nodes[n0].intfs[i0].peer_intf = i1;
+        nodes[n1].intfs[i1].peer_node = n0;
+        nodes[n1].intfs[i1].peer_intf = i0;
+    }
+}
+
+static void free_topology() {
+    for (unsigned i = 0; i < node_count; i++) {
+        dr_router_destroy(nodes[i].router);
+        free(nodes[i].intfs);
+    }
+    free(nodes);
+    free(links);
+    free(addrs);
+    nodes = NULL;
+    links = NULL;
+    addrs = NULL;
+    node_count = link_count = addr_count = 0;
+}
+
+/* ****************************** links ****************************** */
+
+static void enqueue(int node, unsigned intf, uint32_t src_ip, char *buf, unsigned len) {
+    if (queue_tail == queue_capacity) {
+        if (queue_head > 0) {
+            memmove(queue, queue + queue_head, (queue_tail - queue_head) * sizeof(bench_msg_t));
+            queue_tail -= queue_head;
+            queue_head = 0;
+        }
+        if (queue_tail == queue_capacity) {
+            queue_capacity = queue_capacity ? 2 * queue_capacity : 1024;
+            queue = (bench_msg_t *) xrealloc(queue, queue_capacity * sizeof(bench_msg_t));
+        }
+    }
+    bench_msg_t *msg = &queue[queue_tail++];
+    msg->node = node;
+    msg->intf = intf;
+    msg->src_ip = src_ip;
+    msg->len = len;
+    msg->buf = (char *) malloc(len ? len : 1);
+    memcpy(msg->buf, buf, len);
+}
+
+/** delivers packets until the network is quiet */
+static void deliver_all() {
+    while (queue_head < queue_tail) {
+        bench_msg_t msg = queue[queue_head++];
+        bench_node_t *node = &nodes[msg.node];
+        if (node->alive && node->intfs[msg.intf].info.enabled) {
+            dr_router_handle_packet(node->router, msg.src_ip, msg.intf, msg.buf, msg.len);
+        }
+        free(msg.buf);
+    }
+    queue_head = queue_tail = 0;
+}
+
+/* ****************************** dr callbacks ****************************** */
+
+static unsigned cb_interface_count(void *user) {
+    return ((bench_node_t *) user)->intf_count;
+}
+
+static lvns_interface_t cb_get_interface(void *user, unsigned index) {
+    bench_node_t *node = (bench_node_t *) user;
+    lvns_interface_t none;
+    if (index < node->intf_count)
+        return node->intfs[index].info;
+    memset(&none, 0, sizeof(none));
+    return none;
+}
+
+static void cb_send_payload(void *user, uint32_t dst_ip, uint32_t next_hop_ip, uint32_t outgoing_intf,
+                            char *buf, unsigned len) {
+    bench_node_t *node = (bench_node_t *) user;
+    if (outgoing_intf >= node->intf_count)
+        return;
+    bench_intf_t *intf = &node->intfs[outgoing_intf];
+
+    phase.messages++;
+    phase.bytes += len;
+    if (len / BENCH_RIP_ENTRY_SIZE > phase.peak_advert)
+        phase.peak_advert = len / BENCH_RIP_ENTRY_SIZE;
+
+    uint64_t h = fingerprint(buf, len);
+    if (h != intf->last_advert) {
+        intf->last_advert = h;
+        phase.last_change_ms = now_ms;
+        phase.messages_at_change = phase.messages;
+        phase.bytes_at_change = phase.bytes;
+    }
+
+    if (!intf->info.enabled || intf->peer_node < 0)
+        return;
+    bench_node_t *peer = &nodes[intf->peer_node];
+    if (peer->is_router && peer->intfs[intf->peer_intf].info.enabled)
+        enqueue(intf->peer_node, intf->peer_intf, intf->info.ip, buf, len);
+}
+
+/* ****************************** routers ****************************** */
+
+static void start_router(bench_node_t *node) {
+    dr_host_t host;
+
+    host.interface_count = cb_interface_count;
+    host.get_interface = cb_get_interface;
+    host.send_payload = cb_send_payload;
+    host.user = node;
+    node->router = dr_router_create(&host);
+    if (node->router == NULL)
+        die("cannot create router", node->name);
+    dr_router_set_aggregation(node->router, aggregate);
+    if (limited)
+        dr_router_set_route_limits(node->router, &limits);
+    if (rate_limited)
+        dr_router_set_rate_limit(node->router, &rate_limit);
+    if (capture_router != NULL && strcmp(node->name, capture_router) == 0 &&
+        dr_router_capture(node->router, capture_path) != 0)
+        die("cannot capture to", capture_path);
+    if (pcap_router != NULL && strcmp(node->name, pcap_router) == 0 &&
+        dr_router_export_pcap(node->router, pcap_path) != 0)
+        die("cannot export the traffic to", pcap_path);
+}
+
+/** moves virtual time forward by one tick and makes the periodic callbacks */
+static void tick() {
+    now_ms += BENCH_TICK_MS;
+    dr_clock_advance(BENCH_TICK_MS);
+    for (unsigned i = 0; i < node_count; i++) {
+        bench_node_t *node = &nodes[i];
+        if (node->is_router && node->alive) {
+            dr_router_handle_periodic(node->router);
+            deliver_all();
+        }
+    }
+}
+
+/** tells the router owning the interface (if any) about a change */
+static void interface_changed(int node, unsigned intf, int state_changed, int cost_changed) {
+    if (!nodes[node].is_router || !nodes[node].alive)
+        return;
+    dr_router_interface_changed(nodes[node].router, intf, state_changed, cost_changed);
+    deliver_all();
+}
+
+/* ****************************** events ****************************** */
+
+static void phase_begin() {
+    memset(&phase, 0, sizeof(phase));
+    phase.start_ms = phase.last_change_ms = now_ms;
+}
+
+/** makes every router look up the address of every interface */
+static void lookup_all() {
+    for (unsigned i = 0; i < node_count; i++)
+        if (nodes[i].is_router && nodes[i].alive)
+            for (unsigned a = 0; a < addr_count; a++)
+                dr_router_get_next_hop(nodes[i].router, addrs[a].ip);
+}
+
+/** runs steady_periods advertisement intervals; returns the allocations made */
+static uint64_t run_steady() {
+    lookup_all();  /* so that only the steady state is counted */
+    uint64_t before = dr_alloc_count();
+    for (unsigned p = 0; p < steady_periods; p++) {
+        for (long ms = 0; ms < BENCH_ADVERT_MS; ms += BENCH_TICK_MS)
+            tick();
+        lookup_all();
+    }
+    return dr_alloc_count() - before;
+}
+
+static void phase_run_and_report(FILE *out, const char *topo, const char *event, double started) {
+    unsigned routers = 0;
+    for (unsigned i = 0; i < node_count; i++)
+        routers += nodes[i].is_router;
+
+    deliver_all();
+    while (now_ms - phase.last_change_ms < BENCH_QUIET_MS && now_ms - phase.start_ms < BENCH_MAX_PHASE_MS)
+        tick();
+    double elapsed = wall_ms() - started;
+    int converged = now_ms - phase.last_change_ms >= BENCH_QUIET_MS;
+    if (!converged)
+        unconverged = 1;
+
+    /* the largest table and memory of any router, and the sums of the counters */
+    dr_stats_t stats, sum;
+    uint64_t deferred = 0, dropped = 0;
+    memset(&sum, 0, sizeof(sum));
+    for (unsigned i = 0; i < node_count; i++) {
+        if (!nodes[i].is_router)
+            continue;
+        dr_router_get_stats(nodes[i].router, &stats);
+        if (stats.routes > sum.routes)
+            sum.routes = stats.routes;
+        if (stats.memory_bytes > sum.memory_bytes)
+            sum.memory_bytes = stats.memory_bytes;
+        sum.routes_rejected += stats.routes_rejected;
+        sum.routes_evicted += stats.routes_evicted;
+        sum.routes_reclaimed += stats.routes_reclaimed;
+        for (unsigned j = 0; j < stats.intf_count; j++) {
+            deferred += stats.intf[j].adverts_deferred;
+            dropped += stats.intf[j].adverts_dropped;
+        }
+    }
+
+    fprintf(out, "{\"topology\":\"%s\",\"routers\":%u,\"links\":%u,\"event\":\"%s\","
+                 "\"convergence_ms\":%ld,\"converged\":%s,\"messages\":%lu,\"bytes\":%lu,"
+                 "\"peak_advert\":%u,\"max_routes\":%u,\"wall_ms\":%.3f",
+            topo, routers, link_count, event,
+            phase.last_change_ms - phase.start_ms,
+            converged ? "true" : "false",
+            phase.messages_at_change, phase.bytes_at_change,
+            phase.peak_advert, sum.routes, elapsed);
+    if (steady_periods > 0) {
+        uint64_t allocs = run_steady();
+        if (allocs > 0)
+            steady_allocated = 1;
+        fprintf(out, ",\"steady_allocs\":%lu", (unsigned long) allocs);
+    }
+    if (limited)
+        fprintf(out, ",\"max_bytes\":%lu,\"routes_rejected\":%lu,\"routes_evicted\":%lu,\"routes_reclaimed\":%lu",
+                (unsigned long) sum.memory_bytes, (unsigned long) sum.routes_rejected,
+                (unsigned long) sum.routes_evicted, (unsigned long) sum.routes_reclaimed);
+    if (rate_limited)
+        fprintf(out, ",\"adverts_deferred\":%lu,\"adverts_dropped\":%lu",
+                (unsigned long) deferred, (unsigned long) dropped);
+    fprintf(out, "}\n");
+    fflush(out);
+}
+
+/** applies a single event; returns zero if it does not apply to this topology */
+static int apply_event(char *line) {
+    char *argv[8];
+    int argc = 0, n0, n1;
+    unsigned i0, i1;
+    uint32_t ip0, ip1;
+
+    for (char *tok = strtok(line, " \t\r\n"); tok && argc < 8; tok = strtok(NULL, " \t\r\n"))
+        argv[argc++] = tok;
+
+    if (argc == 4 && !strcmp(argv[0], "link") && !strcmp(argv[1], "del")) {
+        if (inet_pton(AF_INET, argv[2], &ip0) != 1 || inet_pton(AF_INET, argv[3], &ip1) != 1 ||
+            !find_interface(ip0, &n0, &i0) || !find_interface(ip1, &n1, &i1))
+            return 0;
+        nodes[n0].intfs[i0].info.enabled = 0;
+        nodes[n1].intfs[i1].info.enabled = 0;
+        interface_changed(n0, i0, 1, 0);
+        interface_changed(n1, i1, 1, 0);
+        return 1;
+    }
+
+    if (argc == 6 && !strcmp(argv[0], "cost") && !strcmp(argv[1], "set") && !strcmp(argv[2], "link")) {
+        if (inet_pton(AF_INET, argv[3], &ip0) != 1 || inet_pton(AF_INET, argv[4], &ip1) != 1 ||
+            !find_interface(ip0, &n0, &i0) || !find_interface(ip1, &n1, &i1))
+            return 0;
+        nodes[n0].intfs[i0].info.cost = atoi(argv[5]);
+        nodes[n1].intfs[i1].info.cost = atoi(argv[5]);
+        interface_changed(n0, i0, 0, 1);
+        interface_changed(n1, i1, 0, 1);
+        return 1;
+    }
+
+    if (argc == 3 && !strcmp(argv[0], "node") && !strcmp(argv[1], "fail")) {
+        for (unsigned i = 0; i < node_count; i++)
+            if (!strcmp(nodes[i].name, argv[2]) && nodes[i].is_router) {
+                nodes[i].alive = 0;
+                return 1;
+            }
+        return 0;
+    }
+
+    return 0;
+}
+
+/** picks a link deletion, a cost change and a node failure in the middle of the topology */
+static unsigned default_events(char events[][BENCH_MAX_LINE]) {
+    char a[INET_ADDRSTRLEN], b[INET_ADDRSTRLEN];
+    unsigned n = 0;
+
+    if (link_count > 0) {
+        bench_link_t *l = &links[link_count / 2];
+        inet_ntop(AF_INET, &l->ip[0], a, sizeof(a));
+        inet_ntop(AF_INET, &l->ip[1], b, sizeof(b));
+        snprintf(events[n++], BENCH_MAX_LINE, "link del %s %s", a, b);
+    }
+    if (link_count > 1) {
+        bench_link_t *l = &links[(link_count / 2 + 1) % link_count];
+        inet_ntop(AF_INET, &l->ip[0], a, sizeof(a));
+        inet_ntop(AF_INET, &l->ip[1], b, sizeof(b));
+        snprintf(events[n++], BENCH_MAX_LINE, "cost set link %s %s 5", a, b);
+    }
+    for (unsigned i = node_count / 2, k = 0; k < node_count; k++, i = (i + 1) % node_count)
+        if (nodes[i].is_router) {
+            snprintf(events[n++], BENCH_MAX_LINE, "node fail %s", nodes[i].name);
+            break;
+        }
+    return n;
+}
+
+static void bench_topology(FILE *out, const char *topo, char events[][BENCH_MAX_LINE], unsigned event_count) {
+    char line[BENCH_MAX_LINE];
+
+    load_topology(topo);
+    now_ms = 0;
+    dr_clock_use_virtual(now_ms);
+
+    /* initial convergence */
+    double started = wall_ms();
+    phase_begin();
+    for (unsigned i = 0; i < node_count; i++)
+        if (nodes[i].is_router)
+            start_router(&nodes[i]);
+    phase_run_and_report(out, topo, "init", started);
+
+    char defaults[3][BENCH_MAX_LINE];
+    if (events == NULL) {
+        event_count = default_events(defaults);
+        events = defaults;
+    }
+
+    for (unsigned i = 0; i < event_count; i++) {
+        memcpy(line, events[i], sizeof(line));
+        started = wall_ms();
+        phase_begin();
+        if (apply_event(line))
+            phase_run_and_report(out, topo, events[i], started);
+        else
+            fprintf(stderr, "dr_bench: %s: skipping event '%s'\n", topo, events[i]);
+    }
+
+    free_topology();
+}
+
+static unsigned load_events(const char *path, char (**events)[BENCH_MAX_LINE]) {
+    char line[BENCH_MAX_LINE];
+    unsigned n = 0;
+    FILE *f = fopen(path, "r");
+    if (f == NULL)
+        die("cannot open events", path);
+
+    *events = NULL;
+    while (fgets(line, sizeof(line), f)) {
+        line[strcspn(line, "\r\n")] = '\0';
+        if (line[strspn(line, " \t")] == '\0' || line[strspn(line, " \t")] == '#')
+            continue;
+        *events = (char (*)[BENCH_MAX_LINE]) xrealloc(*events, (n + 1) * BENCH_MAX_LINE);
+        snprintf((*events)[n++], BENCH_MAX_LINE, "%s", line);
+    }
+    fclose(f);
+    return n;
+}
+
+int main(int argc, char **argv) {
+    char (*events)[BENCH_MAX_LINE] = NULL;
+    unsigned event_count = 0;
+    FILE *out = stdout;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "ac:p:l:r:s:e:o:")) != -1) {
+        switch (opt) {
+            case 'a': aggregate = 1; break;
+            case 'c': {
+                char *colon = strchr(optarg, ':');
+                if (colon == NULL)
+                    die("bad capture (expected ROUTER:FILE)", optarg);
+                *colon = '\0';
+                capture_router = optarg;
+                capture_path = colon + 1;
+                break;
+            }
+            case 'p': {
+                char *colon = strchr(optarg, ':');
+                if (colon == NULL)
+                    die("bad pcap export (expected ROUTER:FILE)", optarg);
+                *colon = '\0';
+                pcap_router = optarg;
+                pcap_path = colon + 1;
+                break;
+            }
+            case 'l': {
+                char policy[16] = "";
+                limited = 1;
+                if (sscanf(optarg, "%u:%u:%15s", &limits.max_routes, &limits.max_neighbour_routes, policy) < 1)
+                    die("bad limits", optarg);
+                limits.policy = strcmp(policy, "short") == 0 ? DR_OVERFLOW_PREFER_SHORT : DR_OVERFLOW_REJECT;
+                break;
+            }
+            case 'r': {
+                char policy[16] = "";
+                rate_limited = 1;
+                if (sscanf(optarg, "%u:%u:%15s", &rate_limit.rate, &rate_limit.burst, policy) < 1)
+                    die("bad rate limit", optarg);
+                rate_limit.policy = strcmp(policy, "defer") == 0 ? DR_RATE_DEFER : DR_RATE_DROP;
+                break;
+            }
+            case 's': steady_periods = strtoul(optarg, NULL, 0); break;
+            case 'e': event_count = load_events(optarg, &events); break;
+            case 'o':
+                out = fopen(optarg, "w");
+                if (out == NULL)
+                    die("cannot open output", optarg);
+                break;
+            default:
+                fprintf(stderr, "Usage: dr_bench [-a] [-c ROUTER:FILE] [-p ROUTER:FILE] [-l LIMITS] [-r RATE] [-s PERIODS] [-e EVENTS] [-o OUTPUT] TOPO...\n");
+                return 1;
+        }
+    }
+    if (optind >= argc) {
+        fprintf(stderr, "Usage: dr_bench [-a] [-c ROUTER:FILE] [-p ROUTER:FILE] [-l LIMITS] [-r RATE] [-s PERIODS] [-e EVENTS] [-o OUTPUT] TOPO...\n");
+        return 1;
+    }
+
+    for (int i = optind; i < argc; i++)
+        bench_topology(out, argv[i], events, event_count);
+
+    if (out != stdout)
+        fclose(out);
+    free(events);
+    free(queue);
+    if (unconverged)
+        fprintf(stderr, "dr_bench: the network did not converge\n");
+    if (steady_allocated)
+        fprintf(stderr, "dr_bench: the library allocated memory in a steady state\n");
+    return unconverged || steady_allocated;
+}
@@ -0,0 +1,134 @@
+/* Filename: dr_capture.c */
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "dr_alloc.h"
+#include "dr_capture.h"
+
+/** records are gathered in a buffer of this size before they are written */
+#define CAPTURE_BUFFER_SIZE (1 << 20)
+
+/** bodies beyond this size are taken as a sign of a corrupt file */
+#define CAPTURE_MAX_BODY (64u << 20)
+
+struct dr_capture_t {
+    FILE* file;
+    char* buffer;
+};
+
+struct dr_capture_reader_t {
+    FILE* file;
+    uint8_t* body;
+    size_t body_size;
+};
+
+dr_capture_t* dr_capture_open(const char* path) {
+    dr_capture_t* capture = (dr_capture_t*) dr_malloc(sizeof(dr_capture_t));
+    char* buffer = (char*) dr_malloc(CAPTURE_BUFFER_SIZE);
+    FILE* file = fopen(path, "wb");
+    if (capture == NULL || buffer == NULL || file == NULL) {
+        if (file != NULL)
+            fclose(file);
+        free(buffer);
+        free(capture);
+        return NULL;
+    }
+    setvbuf(file, buffer, _IOFBF, CAPTURE_BUFFER_SIZE);
+    capture->file = file;
+    capture->buffer = buffer;
+
+    dr_capture_file_t header;
+    header.magic = DR_CAPTURE_MAGIC;
+    header.version = DR_CAPTURE_VERSION;
+    fwrite(&header, sizeof(header), 1, file);
+    return capture;
+}
+
+/* writes the header of a record with a body of len bytes */
+static void write_record(dr_capture_t* capture, dr_capture_type_t type, unsigned flags, long time_ms, size_t len) {
+    dr_capture_record_t record;
+    record.type = (uint8_t) type;
+    record.flags = (uint8_t) flags;
+    record.reserved = 0;
+    record.len = (uint32_t) len;
+    record.time_ms = time_ms;
+    fwrite(&record, sizeof(record), 1, capture->file);
+}
+
+void dr_capture_write(dr_capture_t* capture, dr_capture_type_t type, unsigned flags, long time_ms,
+                      const void* head, size_t head_len, const void* tail, size_t tail_len) {
+    write_record(capture, type, flags, time_ms, head_len + tail_len);
+    if (head_len > 0)
+        fwrite(head, 1, head_len, capture->file);
+    if (tail_len > 0)
+        fwrite(tail, 1, tail_len, capture->file);
+}
+
+void dr_capture_write_interfaces(dr_capture_t* capture, dr_capture_type_t type, unsigned flags, long time_ms,
+                                 const void* head, size_t head_len,
+                                 const lvns_interface_t* intfs, unsigned count) {
+    write_record(capture, type, flags, time_ms, head_len + count * sizeof(dr_capture_intf_t));
+    if (head_len > 0)
+        fwrite(head, 1, head_len, capture->file);
+    for (unsigned i = 0; i < count; i++) {
+        dr_capture_intf_t intf;
+        intf.ip = intfs[i].ip;
+        intf.subnet_mask = intfs[i].subnet_mask;
+        intf.enabled = intfs[i].enabled != 0;
+        intf.cost = intfs[i].cost;
+        fwrite(&intf, sizeof(intf), 1, capture->file);
+    }
+}
+
+void dr_capture_close(dr_capture_t* capture) {
+    if (capture == NULL)
+        return;
+    fclose(capture->file);
+    free(capture->buffer);
+    free(capture);
+}
+
+dr_capture_reader_t* dr_capture_reader_open(const char* path) {
+    dr_capture_reader_t* reader = (dr_capture_reader_t*) dr_calloc(1, sizeof(dr_capture_reader_t));
+    if (reader == NULL)
+        return NULL;
+    reader->file = fopen(path, "rb");
+
+    dr_capture_file_t header;
+    if (reader->file == NULL || fread(&header, sizeof(header), 1, reader->file) != 1 ||
+        header.magic != DR_CAPTURE_MAGIC || header.version != DR_CAPTURE_VERSION) {
+        dr_capture_reader_close(reader);
+        return NULL;
+    }
+    return reader;
+}
+
+int dr_capture_read(dr_capture_reader_t* reader, dr_capture_record_t* record, const uint8_t** body) {
+    size_t got = fread(record, 1, sizeof(dr_capture_record_t), reader->file);
+    if (got == 0)
+        return 0;
+    if (got != sizeof(dr_capture_record_t) || record->len > CAPTURE_MAX_BODY)
+        return -1;
+
+    if (record->len > reader->body_size) {
+        uint8_t* grown = (uint8_t*) dr_realloc(reader->body, record->len);
+        if (grown == NULL)
+            return -1;
+        reader->body = grown;
+        reader->body_size = record->len;
+    }
+    if (fread(reader->body, 1, record->len, reader->file) != record->len)
+        return -1;
+    *body = reader->body;
+    return 1;
+}
+
+void dr_capture_reader_close(dr_capture_reader_t* reader) {
+    if (reader == NULL)
+        return;
+    if (reader->file != NULL)
+        fclose(reader->file);
+    free(reader->body);
+    free(reader);
+}
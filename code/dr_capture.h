@@ -0,0 +1,116 @@
+/*
+ * Filename: dr_capture.h
+ * Purpose:  Capture files: a record of every call into a router (except the
+ *           lookups), with its time, payload and the interfaces it saw, from
+ *           which dr_replay can drive a fresh router the same way.
+ */
+
+#ifndef _DR_CAPTURE_H_
+#define _DR_CAPTURE_H_
+
+#include <stddef.h>  /* size_t */
+#include <stdint.h>
+
+#include "lvns_types.h"
+
+/** a capture file starts with these, in the byte order of the writer */
+#define DR_CAPTURE_MAGIC   0x50414344u  /* "DCAP" */
+#define DR_CAPTURE_VERSION 1
+
+/** the kinds of record; each body is described next to its kind */
+typedef enum dr_capture_type_t {
+    DR_CAPTURE_INTERFACES = 1,  /* the interfaces when the capture started:
+                                   dr_capture_intf_t[]                        */
+    DR_CAPTURE_CONFIG,          /* the settings of the router, when the capture
+                                   started and whenever they change:
+                                   dr_capture_config_t                        */
+    DR_CAPTURE_PACKET,          /* dr_handle_packet: the source IP and the
+                                   interface (uint32_t each), then the payload */
+    DR_CAPTURE_PERIODIC,        /* dr_handle_periodic: no body                */
+    DR_CAPTURE_INTERFACE_CHANGED /* dr_interface_changed: the interface
+                                   (uint32_t), then all the interfaces as they
+                                   are now: dr_capture_intf_t[]               */
+} dr_capture_type_t;
+
+/** flags of a DR_CAPTURE_INTERFACE_CHANGED record */
+#define DR_CAPTURE_STATE_CHANGED 1
+#define DR_CAPTURE_COST_CHANGED  2
+
+/** the header of the file */
+typedef struct dr_capture_file_t {
+    uint32_t magic;
+    uint32_t version;
+} dr_capture_file_t;
+
+/** every record starts with this, and is followed by len bytes of body */
+typedef struct dr_capture_record_t {
+    uint8_t type;       /* a dr_capture_type_t */
+    uint8_t flags;
+    uint16_t reserved;
+    uint32_t len;
+    int64_t time_ms;    /* dr_clock_now() when the call was made */
+} dr_capture_record_t;
+
+/** an interface as recorded (IP and mask in network-byte order) */
+typedef struct dr_capture_intf_t {
+    uint32_t ip;
+    uint32_t subnet_mask;
+    uint32_t enabled;
+    uint32_t cost;
+} dr_capture_intf_t;
+
+/** the settings of a router as recorded (see dr_api.h) */
+typedef struct dr_capture_config_t {
+    uint32_t aggregate;
+    uint32_t compress_fib;
+    uint32_t max_routes;
+    uint32_t max_neighbour_routes;
+    uint32_t overflow_policy;
+    uint32_t rate;
+    uint32_t burst;
+    uint32_t rate_policy;
+} dr_capture_config_t;
+
+typedef struct dr_capture_t dr_capture_t;
+
+/**
+ * Creates (or truncates) the capture file at path and writes its header.
+ * Returns NULL on failure.
+ */
+dr_capture_t* dr_capture_open(const char* path);
+
+/**
+ * Appends a record whose body is head (head_len bytes) followed by tail
+ * (tail_len bytes); either may be NULL if its length is 0.  Records are
+ * buffered, so they only reach the file in large blocks.
+ */
+void dr_capture_write(dr_capture_t* capture, dr_capture_type_t type, unsigned flags, long time_ms,
+                      const void* head, size_t head_len, const void* tail, size_t tail_len);
+
+/**
+ * Appends a record of the count interfaces, after head (head_len bytes, e.g.
+ * the interface of a DR_CAPTURE_INTERFACE_CHANGED record).
+ */
+void dr_capture_write_interfaces(dr_capture_t* capture, dr_capture_type_t type, unsigned flags, long time_ms,
+                                 const void* head, size_t head_len,
+                                 const lvns_interface_t* intfs, unsigned count);
+
+/** Writes out what is buffered and closes the file. */
+void dr_capture_close(dr_capture_t* capture);
+
+typedef struct dr_capture_reader_t dr_capture_reader_t;
+
+/** Opens the capture file at path for reading.  Returns NULL on failure. */
+dr_capture_reader_t* dr_capture_reader_open(const char* path);
+
+/**
+ * Reads the next record into record and points *body at its body, which is
+ * valid until the next call.  Returns 1, 0 at the end of the file or -1 if it
+ * is truncated or corrupt (or out of memory).
+ */
+int dr_capture_read(dr_capture_reader_t* reader, dr_capture_record_t* record, const uint8_t** body);
+
+/** Closes the file. */
+void dr_capture_reader_close(dr_capture_reader_t* reader);
+
+#endif /* _DR_CAPTURE_H_ */
@@ -0,0 +1,41 @@
+/* Filename: dr_clock.c */
+
+#include <time.h>
+#include "dr_clock.h"
+
+/* the coarse clock is served from the vDSO and is plenty for ms timers */
+#ifdef CLOCK_MONOTONIC_COARSE
+#define DR_CLOCK_ID CLOCK_MONOTONIC_COARSE
+#else
+#define DR_CLOCK_ID CLOCK_MONOTONIC
+#endif
+
+static int  use_virtual = 0;   /* boolean; whether the virtual clock is active */
+static long virtual_now = 0;   /* current virtual time in milliseconds         */
+
+long dr_clock_now() {
+    struct timespec now;
+
+    if (__atomic_load_n(&use_virtual, __ATOMIC_RELAXED))
+        return __atomic_load_n(&virtual_now, __ATOMIC_RELAXED);
+
+    clock_gettime(DR_CLOCK_ID, &now);
+    return now.tv_sec * 1000 + now.tv_nsec / 1000000;
+}
+
+void dr_clock_use_virtual(long start_ms) {
+    __atomic_store_n(&virtual_now, start_ms, __ATOMIC_RELAXED);
+    __atomic_store_n(&use_virtual, 1, __ATOMIC_RELEASE);
+}
+
+void dr_clock_use_monotonic() {
+    __atomic_store_n(&use_virtual, 0, __ATOMIC_RELEASE);
+}
+
+int dr_clock_is_virtual() {
+    return __atomic_load_n(&use_virtual, __ATOMIC_ACQUIRE);
+}
+
+void dr_clock_advance(long ms) {
+    __atomic_add_fetch(&virtual_now, ms, __ATOMIC_RELAXED);
+}
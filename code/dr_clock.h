@@ -0,0 +1,32 @@
+/*
+ * Filename: dr_clock.h
+ * Purpose:  The clock which drives every timer in the Dynamic Routing library.
+ *           By default it reads CLOCK_MONOTONIC_COARSE.  Simulations may switch
+ *           to a virtual clock which only moves when it is explicitly advanced.
+ */
+
+#ifndef _DR_CLOCK_H_
+#define _DR_CLOCK_H_
+
+/** Returns the current time in milliseconds on the active clock. */
+long dr_clock_now();
+
+/**
+ * Switches to the virtual clock, starting at start_ms (which must be >= 0).
+ *
+ * This should be called before dr_init.  When the virtual clock is active,
+ * dr_init does not start the periodic thread: whoever advances the clock is
+ * also responsible for calling dr_handle_periodic.
+ */
+void dr_clock_use_virtual(long start_ms);
+
+/** Switches back to the monotonic (production) clock. */
+void dr_clock_use_monotonic();
+
+/** Returns non-zero if the virtual clock is active. */
+int dr_clock_is_virtual();
+
+/** Moves the virtual clock forward by ms milliseconds. */
+void dr_clock_advance(long ms);
+
+#endif /* _DR_CLOCK_H_ */
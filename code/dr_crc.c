@@ -0,0 +1,57 @@
+/* Filename: dr_crc.c */
+
+#include <string.h>
+
+#include "dr_crc.h"
+
+/* the reflected Castagnoli polynomial */
+#define CRC32C_POLY 0x82F63B78u
+
+static uint32_t table[256];
+static int table_ready;
+
+static void build_table() {
+    for (uint32_t i = 0; i < 256; i++) {
+        uint32_t crc = i;
+        for (int bit = 0; bit < 8; bit++)
+            crc = (crc >> 1) ^ (CRC32C_POLY & (0 - (crc & 1)));
+        table[i] = crc;
+    }
+    __atomic_store_n(&table_ready, 1, __ATOMIC_RELEASE);
+}
+
+static uint32_t crc32c_table(uint32_t crc, const unsigned char* p, size_t len) {
+    /* building the table twice is harmless, so racing callers are fine */
+    if (!__atomic_load_n(&table_ready, __ATOMIC_ACQUIRE))
+        build_table();
+    while (len-- > 0)
+        crc = (crc >> 8) ^ table[(crc ^ *p++) & 0xFF];
+    return crc;
+}
+
+#if defined(__x86_64__)
+__attribute__ ((target ("sse4.2")))
+static uint32_t crc32c_sse42(uint32_t crc, const unsigned char* p, size_t len) {
+    uint64_t crc64 = crc;
+    for (; len >= 8; p += 8, len -= 8) {
+        uint64_t word;
+        memcpy(&word, p, sizeof(word));
+        crc64 = __builtin_ia32_crc32di(crc64, word);
+    }
+    crc = (uint32_t) crc64;
+    for (; len > 0; p++, len--)
+        crc = __builtin_ia32_crc32qi(crc, *p);
+    return crc;
+}
+#endif
+
+uint32_t dr_crc32c(uint32_t crc, const void* buf, size_t len) {
+    const unsigned char* p = (const unsigned char*) buf;
+
+    crc = ~crc;
+#if defined(__x86_64__)
+    if (__builtin_cpu_supports("sse4.2"))
+        return ~crc32c_sse42(crc, p, len);
+#endif
+    return ~crc32c_table(crc, p, len);
+}
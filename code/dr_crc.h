@@ -0,0 +1,20 @@
+/*
+ * Filename: dr_crc.h
+ * Purpose:  CRC-32C (Castagnoli) checksums, used to fingerprint advertisements.
+ *           Computed with the SSE4.2 crc32 instruction, eight bytes at a time,
+ *           where the CPU has it and with a lookup table otherwise.
+ */
+
+#ifndef _DR_CRC_H_
+#define _DR_CRC_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+/**
+ * Returns the CRC-32C of the len bytes at buf.  Pass 0 as crc to start a new
+ * checksum, or the result of a previous call to continue it.
+ */
+uint32_t dr_crc32c(uint32_t crc, const void* buf, size_t len);
+
+#endif /* _DR_CRC_H_ */
@@ -0,0 +1,749 @@
+/* Filename: dr_fib.c */
+
+#include <arpa/inet.h>  /* ntohl */
+#include <stdlib.h>
+#include <string.h>
+#if defined(__x86_64__)
+#include <immintrin.h>
+#endif
+
+#include "dr_alloc.h"
+#include "dr_fib.h"
+
+/* a FIB_TRIE slot refers to a node (this bit and its index), to an entry (its
+   index + 1) or to nothing (0) */
+#define TRIE_NODE       0x80000000u
+#define TRIE_ROOT_SLOTS 65536
+#define TRIE_NODE_SLOTS 256
+
+/* the Bloom filters set this many bits per prefix, in a block of 512 bits (a
+   cache line) picked by the prefix, and have about 16 bits per prefix */
+#define BLOOM_HASHES 3
+#define BLOOM_BLOCK_WORDS 8
+#define BLOOM_BITS_PER_PREFIX 16
+
+/** a slot of the FIB_BLOOM hash table of a prefix length */
+typedef struct bloom_slot_t {
+    uint32_t prefix;            /* in host order */
+    uint32_t used;
+    next_hop_t hop;
+} bloom_slot_t;
+
+/** the prefixes of one length, for FIB_BLOOM; the buffers are kept from one
+    load to the next and only grow */
+typedef struct bloom_length_t {
+    unsigned len;
+    uint32_t mask;              /* in host order */
+    uint64_t* filter;           /* blocks of BLOOM_BLOCK_WORDS words */
+    unsigned blocks;            /* a power of two */
+    unsigned filter_capacity;   /* in blocks */
+    bloom_slot_t* slots;        /* open addressing, linear probing */
+    unsigned slot_count;        /* a power of two, at least twice the prefixes */
+    unsigned slot_capacity;
+} bloom_length_t;
+
+struct fib_t {
+    /* FIB_SMALL: the entries as in entries, in slots of which the unused ones
+       never match, and their hops (the one after the last slot is no route) */
+    uint32_t small_prefix[FIB_SMALL_MAX] __attribute__ ((aligned (32)));
+    uint32_t small_mask[FIB_SMALL_MAX] __attribute__ ((aligned (32)));
+    next_hop_t small_hop[FIB_SMALL_MAX + 1];
+    int small_avx2;             /* whether the CPU has AVX2 */
+
+    fib_backend_t backend;
+    fib_backend_t active;       /* the structure loaded (never FIB_AUTO) */
+
+    /* the entries, longest prefix first; FIB_LINEAR uses nothing else */
+    fib_entry_t* entries;
+    unsigned size;
+    unsigned capacity;
+
+    /* FIB_TRIE: the slots of the first 16 bits, and nodes of 256 slots for the
+       next 8 (and the last 8) bits */
+    uint32_t* trie_root;
+    uint32_t* trie_nodes;
+    unsigned trie_node_count;
+    unsigned trie_node_capacity;
+
+    /* FIB_BLOOM: the prefix lengths in use, longest first (those after them
+       only hold on to their buffers) */
+    bloom_length_t bloom[33];
+    unsigned bloom_count;
+};
+
+/* orders by prefix length (longest first), then by prefix */
+static int cmp_longest_first(const void* a, const void* b) {
+    const fib_entry_t* x = (const fib_entry_t*) a;
+    const fib_entry_t* y = (const fib_entry_t*) b;
+    uint32_t mx = ntohl(x->mask), my = ntohl(y->mask);
+    uint32_t px = ntohl(x->prefix), py = ntohl(y->prefix);
+
+    if (mx != my)
+        return mx > my ? -1 : 1;
+    return px < py ? -1 : px > py;
+}
+
+fib_t* fib_create(fib_backend_t backend) {
+    void* p = dr_aligned_alloc(64, sizeof(fib_t));
+    if (p == NULL)
+        return NULL;
+    fib_t* fib = (fib_t*) memset(p, 0, sizeof(fib_t));
+    fib->backend = backend;
+    fib->active = FIB_LINEAR;   /* which misses while there are no entries */
+#if defined(__x86_64__)
+    fib->small_avx2 = __builtin_cpu_supports("avx2");
+#endif
+    return fib;
+}
+
+static void free_trie(fib_t* fib) {
+    free(fib->trie_root);
+    free(fib->trie_nodes);
+    fib->trie_root = NULL;
+    fib->trie_nodes = NULL;
+    fib->trie_node_count = fib->trie_node_capacity = 0;
+}
+
+static void free_bloom(fib_t* fib) {
+    for (unsigned i = 0; i < 33; i++) {
+        free(fib->bloom[i].filter);
+        free(fib->bloom[i].slots);
+    }
+    memset(fib->bloom, 0, sizeof(fib->bloom));
+    fib->bloom_count = 0;
+}
+
+void fib_destroy(fib_t* fib) {
+    if (fib == NULL)
+        return;
+    free(fib->entries);
+    free_trie(fib);
+    free_bloom(fib);
+    free(fib);
+}
+
+static uint64_t bloom_hash(uint32_t prefix) {
+    uint64_t h = (uint64_t) prefix * 0x9E3779B97F4A7C15ULL;
+    return h ^ (h >> 29);
+}
+
+/* whether the filter may contain the prefix hashed to h */
+static int bloom_test(const bloom_length_t* b, uint64_t h) {
+    const uint64_t* block = b->filter + ((h >> 40) & (b->blocks - 1)) * BLOOM_BLOCK_WORDS;
+    int hit = 1;
+    for (unsigned k = 0; k < BLOOM_HASHES; k++) {
+        unsigned bit = (h >> (9 * k)) & 511;
+        hit &= (int) (block[bit >> 6] >> (bit & 63)) & 1;
+    }
+    return hit;
+}
+
+/* builds a filter and hash table per prefix length from the entries; false if
+   out of memory */
+static int load_bloom(fib_t* fib) {
+    unsigned counts[33] = {0};
+    for (unsigned i = 0; i < fib->size; i++)
+        counts[__builtin_popcount(ntohl(fib->entries[i].mask))]++;
+
+    fib->bloom_count = 0;
+    for (int len = 32; len >= 0; len--) {
+        if (counts[len] == 0)
+            continue;
+        bloom_length_t* b = &fib->bloom[fib->bloom_count++];
+        b->len = len;
+        b->mask = len ? 0xFFFFFFFFu << (32 - len) : 0;
+        b->blocks = 1;
+        while (b->blocks * BLOOM_BLOCK_WORDS * 64 < counts[len] * BLOOM_BITS_PER_PREFIX)
+            b->blocks *= 2;
+        b->slot_count = 2;
+        while (b->slot_count < 2 * counts[len])
+            b->slot_count *= 2;
+        if (b->blocks > b->filter_capacity) {
+            uint64_t* grown = (uint64_t*) dr_realloc(b->filter, (size_t) b->blocks * BLOOM_BLOCK_WORDS * sizeof(uint64_t));
+            if (grown == NULL) {
+                free_bloom(fib);
+                return 0;
+            }
+            b->filter = grown;
+            b->filter_capacity = b->blocks;
+        }
+        if (b->slot_count > b->slot_capacity) {
+            bloom_slot_t* grown = (bloom_slot_t*) dr_realloc(b->slots, b->slot_count * sizeof(bloom_slot_t));
+            if (grown == NULL) {
+                free_bloom(fib);
+                return 0;
+            }
+            b->slots = grown;
+            b->slot_capacity = b->slot_count;
+        }
+        memset(b->filter, 0, (size_t) b->blocks * BLOOM_BLOCK_WORDS * sizeof(uint64_t));
+        memset(b->slots, 0, b->slot_count * sizeof(bloom_slot_t));
+    }
+
+    for (unsigned i = 0; i < fib->size; i++) {
+        const fib_entry_t* e = &fib->entries[i];
+        unsigned len = __builtin_popcount(ntohl(e->mask));
+        bloom_length_t* b = fib->bloom;
+        while (b->len != len)
+            b++;
+
+        uint32_t prefix = ntohl(e->prefix);
+        uint64_t h = bloom_hash(prefix);
+        uint64_t* block = b->filter + ((h >> 40) & (b->blocks - 1)) * BLOOM_BLOCK_WORDS;
+        for (unsigned k = 0; k < BLOOM_HASHES; k++) {
+            unsigned bit = (h >> (9 * k)) & 511;
+            block[bit >> 6] |= 1ULL << (bit & 63);
+        }
+
+        unsigned slot = (unsigned) (h >> 32) & (b->slot_count - 1);
+        while (b->slots[slot].used)
+            slot = (slot + 1) & (b->slot_count - 1);
+        b->slots[slot].prefix = prefix;
+        b->slots[slot].used = 1;
+        b->slots[slot].hop = e->hop;
+    }
+    return 1;
+}
+
+/* fills the slots of the first size entries; false if there are too many */
+static int load_small(fib_t* fib) {
+    if (fib->size > FIB_SMALL_MAX)
+        return 0;
+    for (unsigned i = 0; i < FIB_SMALL_MAX; i++) {
+        if (i < fib->size) {
+            fib->small_prefix[i] = fib->entries[i].prefix;
+            fib->small_mask[i] = fib->entries[i].mask;
+            fib->small_hop[i] = fib->entries[i].hop;
+        } else {
+            /* no address masked with 0 is 1 */
+            fib->small_prefix[i] = htonl(1);
+            fib->small_mask[i] = 0;
+            fib->small_hop[i].interface = 0;
+            fib->small_hop[i].dst_ip = 0xFFFFFFFF;
+        }
+    }
+    fib->small_hop[FIB_SMALL_MAX].interface = 0;
+    fib->small_hop[FIB_SMALL_MAX].dst_ip = 0xFFFFFFFF;
+    return 1;
+}
+
+/* returns the index of a new node whose slots are all value, or 0 if out of
+   memory (node 0 is made first and never used, so 0 is no node) */
+static unsigned trie_new_node(fib_t* fib, uint32_t value) {
+    if (fib->trie_node_count == fib->trie_node_capacity) {
+        unsigned capacity = fib->trie_node_capacity ? 2 * fib->trie_node_capacity : 16;
+        uint32_t* grown = (uint32_t*) dr_realloc(fib->trie_nodes, (size_t) capacity * TRIE_NODE_SLOTS * sizeof(uint32_t));
+        if (grown == NULL)
+            return 0;
+        fib->trie_nodes = grown;
+        fib->trie_node_capacity = capacity;
+    }
+    uint32_t* slots = fib->trie_nodes + (size_t) fib->trie_node_count * TRIE_NODE_SLOTS;
+    for (unsigned i = 0; i < TRIE_NODE_SLOTS; i++)
+        slots[i] = value;
+    return fib->trie_node_count++;
+}
+
+/* sets the slots a prefix covers to value, where the slots are indexed by bits
+   bits of which the prefix fixes len, and the first one is first */
+static void trie_fill(uint32_t* slots, unsigned first, unsigned bits, unsigned len, uint32_t value) {
+    unsigned count = 1u << (bits - len);
+    for (unsigned i = 0; i < count; i++)
+        slots[first + i] = value;
+}
+
+static uint32_t* trie_slots(const fib_t* fib, unsigned node) {
+    return fib->trie_nodes + (size_t) node * TRIE_NODE_SLOTS;
+}
+
+/* returns the node which slot index of parent (0: of the root) refers to,
+   making it first from what the slot held if needed; 0 if out of memory */
+static unsigned trie_child(fib_t* fib, unsigned parent, unsigned index) {
+    uint32_t value = parent == 0 ? fib->trie_root[index] : trie_slots(fib, parent)[index];
+    if (value & TRIE_NODE)
+        return value & ~TRIE_NODE;
+
+    unsigned node = trie_new_node(fib, value);
+    if (node != 0)
+        (parent == 0 ? fib->trie_root : trie_slots(fib, parent))[index] = TRIE_NODE | node;
+    return node;
+}
+
+/* clears the root slots the entries set, which leaves it all zeros when the
+   trie was built from them: cheaper than clearing all of it when they are few */
+static void clear_trie_root(fib_t* fib) {
+    for (unsigned i = 0; i < fib->size; i++) {
+        uint32_t prefix = ntohl(fib->entries[i].prefix);
+        unsigned len = __builtin_popcount(ntohl(fib->entries[i].mask));
+        if (len <= 16)
+            trie_fill(fib->trie_root, prefix >> 16, 16, len, 0);
+        else
+            fib->trie_root[prefix >> 16] = 0;
+    }
+}
+
+/* builds the trie from the entries into a root of zeros; false if out of memory */
+static int load_trie(fib_t* fib) {
+    if (fib->trie_root == NULL) {
+        fib->trie_root = (uint32_t*) dr_calloc(TRIE_ROOT_SLOTS, sizeof(uint32_t));
+        if (fib->trie_root == NULL)
+            return 0;
+    }
+    fib->trie_node_count = 0;
+    trie_new_node(fib, 0);  /* node 0, which stands for no node */
+    if (fib->trie_node_count != 1)
+        return 0;
+
+    /* shortest prefix first, so the longer ones overwrite the slots they share */
+    for (unsigned i = fib->size; i-- > 0;) {
+        const fib_entry_t* e = &fib->entries[i];
+        uint32_t prefix = ntohl(e->prefix);
+        unsigned len = __builtin_popcount(ntohl(e->mask));
+        uint32_t value = i + 1;
+
+        if (len <= 16) {
+            trie_fill(fib->trie_root, prefix >> 16, 16, len, value);
+            continue;
+        }
+        unsigned node = trie_child(fib, 0, prefix >> 16);
+        if (node == 0)
+            return 0;
+        if (len <= 24) {
+            trie_fill(trie_slots(fib, node), (prefix >> 8) & 0xFF, 8, len - 16, value);
+            continue;
+        }
+        node = trie_child(fib, node, (prefix >> 8) & 0xFF);
+        if (node == 0)
+            return 0;
+        trie_fill(trie_slots(fib, node), prefix & 0xFF, 8, len - 24, value);
+    }
+    return 1;
+}
+
+int fib_load(fib_t* fib, const fib_entry_t* entries, unsigned n) {
+    if (n > fib->capacity) {
+        fib_entry_t* grown = (fib_entry_t*) dr_realloc(fib->entries, n * sizeof(fib_entry_t));
+        if (grown == NULL)
+            return -1; /* keep the previous contents rather than lose every route */
+        fib->entries = grown;
+        fib->capacity = n;
+    }
+    if (fib->trie_root != NULL)
+        clear_trie_root(fib);  /* while the entries it was built from are still here */
+    if (n > 0)
+        memcpy(fib->entries, entries, n * sizeof(fib_entry_t));
+    for (unsigned i = 0; i < n; i++)
+        fib->entries[i].prefix &= fib->entries[i].mask;
+    qsort(fib->entries, n, sizeof(fib_entry_t), cmp_longest_first);
+
+    /* drop duplicates */
+    unsigned size = 0;
+    for (unsigned i = 0; i < n; i++) {
+        if (size > 0 && fib->entries[size - 1].prefix == fib->entries[i].prefix &&
+            fib->entries[size - 1].mask == fib->entries[i].mask)
+            continue;
+        fib->entries[size++] = fib->entries[i];
+    }
+    fib->size = size;
+
+    fib_backend_t want = fib->backend;
+    if (want == FIB_AUTO)
+        want = size <= FIB_SMALL_MAX ? FIB_SMALL : FIB_TRIE;
+    if (want == FIB_SMALL && !load_small(fib))
+        want = FIB_LINEAR;
+    if (want == FIB_TRIE && !load_trie(fib))
+        want = FIB_LINEAR;  /* slower, but right */
+    if (want == FIB_BLOOM && !load_bloom(fib))
+        want = FIB_LINEAR;
+    if (want != FIB_TRIE)
+        free_trie(fib);  /* its memory is kept only while it is in use */
+    if (want != FIB_BLOOM)
+        free_bloom(fib);
+    fib->active = want;
+    return 0;
+}
+
+/*
+ * ORTC works on a binary trie of the prefixes.  First every node gets either no
+ * children or both, a new leaf taking the next hop its addresses inherit.  Then,
+ * bottom up, each node is given the set of next hops its subtree could inherit
+ * from above at the least cost: a leaf its own hop, an inner node the hops its
+ * children have in common, or all of theirs if they have none in common.
+ * Finally, top down, a node needs a prefix of its own only where the hop it
+ * inherits is not in its set.
+ */
+
+/** a node of the trie; node 0 is the root, so 0 means no child */
+typedef struct ortc_node_t {
+    unsigned child[2];
+    int hop;            /* the hop of the prefix ending here, -1 if none */
+    unsigned set;       /* the set of hops is pool[set] to pool[set + len - 1] */
+    unsigned len;
+} ortc_node_t;
+
+typedef struct ortc_t {
+    ortc_node_t* nodes;
+    unsigned node_count;
+    unsigned node_capacity;
+
+    /* sets of hops (sorted); pool[i] = i at the start, the sets of the leaves */
+    unsigned* pool;
+    unsigned pool_size;
+    unsigned pool_capacity;
+
+    /* the distinct next hops; hops[0] is "no route" */
+    next_hop_t* hops;
+    unsigned hop_count;
+
+    fib_entry_t* out;
+    unsigned out_count;
+    unsigned out_capacity;
+    int failed;
+} ortc_t;
+
+static int is_no_route(const next_hop_t* hop) {
+    return hop->dst_ip == 0xFFFFFFFF;
+}
+
+static int cmp_hop(const void* a, const void* b) {
+    const next_hop_t* x = (const next_hop_t*) a;
+    const next_hop_t* y = (const next_hop_t*) b;
+    if (x->dst_ip != y->dst_ip)
+        return x->dst_ip < y->dst_ip ? -1 : 1;
+    return x->interface < y->interface ? -1 : x->interface > y->interface;
+}
+
+static unsigned hop_id(const ortc_t* o, const next_hop_t* hop) {
+    if (is_no_route(hop))
+        return 0;
+    const next_hop_t* found = (const next_hop_t*) bsearch(hop, o->hops + 1, o->hop_count - 1,
+                                                          sizeof(next_hop_t), cmp_hop);
+    return (unsigned) (found - o->hops);
+}
+
+/* returns the index of a new childless node, or 0 if out of memory */
+static unsigned ortc_new_node(ortc_t* o) {
+    if (o->node_count == o->node_capacity) {
+        unsigned capacity = o->node_capacity ? 2 * o->node_capacity : 64;
+        ortc_node_t* grown = (ortc_node_t*) dr_realloc(o->nodes, capacity * sizeof(ortc_node_t));
+        if (grown == NULL) {
+            o->failed = 1;
+            return 0;
+        }
+        o->nodes = grown;
+        o->node_capacity = capacity;
+    }
+    ortc_node_t* node = &o->nodes[o->node_count];
+    node->child[0] = node->child[1] = 0;
+    node->hop = -1;
+    node->set = node->len = 0;
+    return o->node_count++;
+}
+
+static void ortc_insert(ortc_t* o, const fib_entry_t* entry) {
+    uint32_t prefix = ntohl(entry->prefix & entry->mask);
+    unsigned len = __builtin_popcount(ntohl(entry->mask));
+    unsigned node = 0;
+
+    for (unsigned depth = 0; depth < len; depth++) {
+        unsigned bit = (prefix >> (31 - depth)) & 1;
+        if (o->nodes[node].child[bit] == 0) {
+            unsigned child = ortc_new_node(o);
+            if (child == 0)
+                return;
+            o->nodes[node].child[bit] = child;
+        }
+        node = o->nodes[node].child[bit];
+    }
+    if (o->nodes[node].hop < 0)
+        o->nodes[node].hop = (int) hop_id(o, &entry->hop);
+}
+
+/* makes room for another len hops at the end of the pool */
+static int ortc_reserve(ortc_t* o, unsigned len) {
+    if (o->pool_size + len <= o->pool_capacity)
+        return 1;
+    unsigned capacity = 2 * o->pool_capacity > o->pool_size + len ? 2 * o->pool_capacity : o->pool_size + len;
+    unsigned* grown = (unsigned*) dr_realloc(o->pool, capacity * sizeof(unsigned));
+    if (grown == NULL) {
+        o->failed = 1;
+        return 0;
+    }
+    o->pool = grown;
+    o->pool_capacity = capacity;
+    return 1;
+}
+
+/* completes the subtree below node and gives each of its nodes its set */
+static void ortc_sets(ortc_t* o, unsigned node, unsigned inherited) {
+    unsigned hop = o->nodes[node].hop >= 0 ? (unsigned) o->nodes[node].hop : inherited;
+
+    if (o->nodes[node].child[0] == 0 && o->nodes[node].child[1] == 0) {
+        o->nodes[node].set = hop;
+        o->nodes[node].len = 1;
+        return;
+    }
+    for (unsigned bit = 0; bit < 2; bit++) {
+        if (o->nodes[node].child[bit] == 0) {
+            unsigned child = ortc_new_node(o);
+            if (child == 0)
+                return;
+            o->nodes[node].child[bit] = child;
+        }
+        ortc_sets(o, o->nodes[node].child[bit], hop);
+        if (o->failed)
+            return;
+    }
+
+    const ortc_node_t* a = &o->nodes[o->nodes[node].child[0]];
+    const ortc_node_t* b = &o->nodes[o->nodes[node].child[1]];
+    if (!ortc_reserve(o, a->len + b->len))
+        return;
+    const unsigned* x = o->pool + a->set;
+    const unsigned* y = o->pool + b->set;
+    unsigned* out = o->pool + o->pool_size;
+    unsigned i = 0, j = 0, len = 0;
+
+    while (i < a->len && j < b->len) {
+        if (x[i] < y[j])
+            i++;
+        else if (x[i] > y[j])
+            j++;
+        else {
+            out[len++] = x[i];
+            i++;
+            j++;
+        }
+    }
+    if (len == a->len || len == b->len) {
+        /* one set contains the other, which can be shared */
+        o->nodes[node].set = len == a->len ? a->set : b->set;
+        o->nodes[node].len = len;
+        return;
+    }
+    if (len == 0) {
+        for (i = 0, j = 0; i < a->len || j < b->len;) {
+            if (j == b->len || (i < a->len && x[i] < y[j]))
+                out[len++] = x[i++];
+            else
+                out[len++] = y[j++];
+        }
+    }
+    o->nodes[node].set = o->pool_size;
+    o->nodes[node].len = len;
+    o->pool_size += len;
+}
+
+static int ortc_contains(const ortc_t* o, const ortc_node_t* node, unsigned hop) {
+    unsigned lo = node->set, hi = node->set + node->len;
+    while (lo < hi) {
+        unsigned mid = (lo + hi) / 2;
+        if (o->pool[mid] < hop)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    return lo < node->set + node->len && o->pool[lo] == hop;
+}
+
+/* adds the prefixes the subtree below node needs, given the hop it inherits */
+static void ortc_emit(ortc_t* o, unsigned node, uint32_t prefix, unsigned depth, unsigned inherited) {
+    const ortc_node_t* n = &o->nodes[node];
+    unsigned hop = inherited;
+
+    if (!ortc_contains(o, n, inherited)) {
+        if (o->out_count == o->out_capacity) {
+            o->failed = 1;  /* no smaller than the original */
+            return;
+        }
+        hop = o->pool[n->set];
+        fib_entry_t* e = &o->out[o->out_count++];
+        e->prefix = htonl(prefix);
+        e->mask = htonl(depth ? 0xFFFFFFFFu << (32 - depth) : 0);
+        e->hop = o->hops[hop];
+    }
+    if (n->child[0] != 0) {
+        unsigned zero = n->child[0], one = n->child[1];
+        ortc_emit(o, zero, prefix, depth + 1, hop);
+        ortc_emit(o, one, prefix | (1u << (31 - depth)), depth + 1, hop);
+    }
+}
+
+int fib_compress(fib_entry_t* entries, unsigned n) {
+    ortc_t o;
+    int result = -1;
+
+    if (n == 0)
+        return 0;
+    memset(&o, 0, sizeof(o));
+    o.hops = (next_hop_t*) dr_malloc((n + 1) * sizeof(next_hop_t));
+    o.out = (fib_entry_t*) dr_malloc(n * sizeof(fib_entry_t));
+    if (o.hops == NULL || o.out == NULL)
+        goto done;
+    o.out_capacity = n;
+
+    o.hops[0].interface = 0;
+    o.hops[0].dst_ip = 0xFFFFFFFF;
+    o.hop_count = 1;
+    for (unsigned i = 0; i < n; i++)
+        if (!is_no_route(&entries[i].hop))
+            o.hops[o.hop_count++] = entries[i].hop;
+    qsort(o.hops + 1, o.hop_count - 1, sizeof(next_hop_t), cmp_hop);
+    {
+        unsigned distinct = 1;
+        for (unsigned i = 1; i < o.hop_count; i++)
+            if (distinct == 1 || cmp_hop(&o.hops[distinct - 1], &o.hops[i]) != 0)
+                o.hops[distinct++] = o.hops[i];
+        o.hop_count = distinct;
+    }
+
+    if (!ortc_reserve(&o, 2 * o.hop_count))
+        goto done;
+    for (unsigned i = 0; i < o.hop_count; i++)
+        o.pool[i] = i;
+    o.pool_size = o.hop_count;
+
+    ortc_new_node(&o);
+    for (unsigned i = 0; i < n && !o.failed; i++)
+        ortc_insert(&o, &entries[i]);
+    if (!o.failed)
+        ortc_sets(&o, 0, 0);
+    if (!o.failed)
+        ortc_emit(&o, 0, 0, 0, 0);  /* no route is the default */
+    if (!o.failed) {
+        memcpy(entries, o.out, o.out_count * sizeof(fib_entry_t));
+        result = (int) o.out_count;
+    }
+
+done:
+    free(o.nodes);
+    free(o.pool);
+    free(o.hops);
+    free(o.out);
+    return result;
+}
+
+/*
+ * FIB_SMALL: each returns the index of the first (longest) slot matching ip,
+ * or FIB_SMALL_MAX if none does.  Every slot is compared, in a loop of fixed
+ * length the compiler unrolls; the matches are gathered into a bit mask and the
+ * first is found by counting trailing zeros, so there is no branch per slot.
+ */
+#if defined(__x86_64__)
+__attribute__ ((target ("avx2")))
+static unsigned small_match_avx2(const fib_t* fib, uint32_t ip) {
+    __m256i addr = _mm256_set1_epi32((int) ip);
+    uint64_t hits = 0;
+
+#pragma GCC unroll 8
+    for (unsigned g = 0; g < FIB_SMALL_MAX / 8; g++) {
+        __m256i mask = _mm256_load_si256((const __m256i*) &fib->small_mask[8 * g]);
+        __m256i prefix = _mm256_load_si256((const __m256i*) &fib->small_prefix[8 * g]);
+        __m256i eq = _mm256_cmpeq_epi32(_mm256_and_si256(addr, mask), prefix);
+        hits |= (uint64_t) (unsigned) _mm256_movemask_ps(_mm256_castsi256_ps(eq)) << (8 * g);
+    }
+    return hits ? __builtin_ctzll(hits) : FIB_SMALL_MAX;
+}
+
+static unsigned small_match_sse2(const fib_t* fib, uint32_t ip) {
+    __m128i addr = _mm_set1_epi32((int) ip);
+    uint64_t hits = 0;
+
+#pragma GCC unroll 16
+    for (unsigned q = 0; q < FIB_SMALL_MAX / 4; q++) {
+        __m128i mask = _mm_load_si128((const __m128i*) &fib->small_mask[4 * q]);
+        __m128i prefix = _mm_load_si128((const __m128i*) &fib->small_prefix[4 * q]);
+        __m128i eq = _mm_cmpeq_epi32(_mm_and_si128(addr, mask), prefix);
+        hits |= (uint64_t) (unsigned) _mm_movemask_ps(_mm_castsi128_ps(eq)) << (4 * q);
+    }
+    return hits ? __builtin_ctzll(hits) : FIB_SMALL_MAX;
+}
+#else
+static unsigned small_match_scalar(const fib_t* fib, uint32_t ip) {
+    uint64_t hits = 0;
+
+    for (unsigned i = 0; i < FIB_SMALL_MAX; i++)
+        hits |= (uint64_t) ((ip & fib->small_mask[i]) == fib->small_prefix[i]) << i;
+    return hits ? __builtin_ctzll(hits) : FIB_SMALL_MAX;
+}
+#endif
+
+next_hop_t fib_lookup(const fib_t* fib, uint32_t ip) {
+    next_hop_t hop;
+
+    switch (fib->active) {
+        case FIB_SMALL:
+#if defined(__x86_64__)
+            if (fib->small_avx2)
+                return fib->small_hop[small_match_avx2(fib, ip)];
+            return fib->small_hop[small_match_sse2(fib, ip)];
+#else
+            return fib->small_hop[small_match_scalar(fib, ip)];
+#endif
+
+        case FIB_TRIE: {
+            uint32_t host = ntohl(ip);
+            uint32_t value = fib->trie_root[host >> 16];
+            if (value & TRIE_NODE)
+                value = trie_slots(fib, value & ~TRIE_NODE)[(host >> 8) & 0xFF];
+            if (value & TRIE_NODE)
+                value = trie_slots(fib, value & ~TRIE_NODE)[host & 0xFF];
+            if (value != 0)
+                return fib->entries[value - 1].hop;
+            break;
+        }
+
+        case FIB_BLOOM: {
+            uint32_t host = ntohl(ip);
+            for (unsigned i = 0; i < fib->bloom_count; i++) {
+                const bloom_length_t* b = &fib->bloom[i];
+                uint32_t prefix = host & b->mask;
+                uint64_t h = bloom_hash(prefix);
+                if (!bloom_test(b, h))
+                    continue;
+                for (unsigned slot = (unsigned) (h >> 32) & (b->slot_count - 1); b->slots[slot].used;
+                     slot = (slot + 1) & (b->slot_count - 1))
+                    if (b->slots[slot].prefix == prefix)
+                        return b->slots[slot].hop;
+            }
+            break;
+        }
+
+        default:
+            for (unsigned i = 0; i < fib->size; i++) {
+                const fib_entry_t* e = &fib->entries[i];
+                if ((ip & e->mask) == e->prefix)
+                    return e->hop;
+            }
+    }
+
+    hop.interface = 0;
+    hop.dst_ip = 0xFFFFFFFF;
+    return hop;
+}
+
+unsigned fib_size(const fib_t* fib) {
+    return fib->size;
+}
+
+size_t fib_memory(const fib_t* fib) {
+    size_t bytes = sizeof(fib_t) + fib->capacity * sizeof(fib_entry_t);
+    if (fib->trie_root != NULL)
+        bytes += TRIE_ROOT_SLOTS * sizeof(uint32_t) +
+                 (size_t) fib->trie_node_capacity * TRIE_NODE_SLOTS * sizeof(uint32_t);
+    for (unsigned i = 0; i < 33; i++)
+        bytes += (size_t) fib->bloom[i].filter_capacity * BLOOM_BLOCK_WORDS * sizeof(uint64_t) +
+                 (size_t) fib->bloom[i].slot_capacity * sizeof(bloom_slot_t);
+    return bytes;
+}
+
+const char* fib_backend_name(fib_backend_t backend) {
+    switch (backend) {
+        case FIB_LINEAR: return "linear";
+        case FIB_TRIE:   return "trie";
+        case FIB_SMALL:  return "small";
+        case FIB_AUTO:   return "auto";
+        case FIB_BLOOM:  return "bloom";
+    }
+    return "unknown";
+}
@@ -0,0 +1,83 @@
+/*
+ * Filename: dr_fib.h
+ * Purpose:  The forwarding table (FIB) which answers dr_get_next_hop.  It is a
+ *           read-only snapshot of the usable routes of the routing table,
+ *           rebuilt whenever those change, behind which different lookup
+ *           structures (backends) can be plugged.
+ */
+
+#ifndef _DR_FIB_H_
+#define _DR_FIB_H_
+
+#ifdef _LINUX_
+#include <stdint.h>
+#endif
+#include <stddef.h>  /* size_t */
+
+#include "lvns_types.h"
+
+/** a single prefix in the FIB (prefix and mask in network-byte order) */
+typedef struct fib_entry_t {
+    uint32_t prefix;   /* already masked */
+    uint32_t mask;
+    next_hop_t hop;
+} fib_entry_t;
+
+/** the most entries FIB_SMALL compares at once (a multiple of 8) */
+#define FIB_SMALL_MAX 64
+
+/** the lookup structures a FIB can be built with */
+typedef enum fib_backend_t {
+    FIB_LINEAR,      /* entries sorted longest prefix first, first match wins */
+    FIB_TRIE,        /* multibit trie with strides 16, 8 and 8: at most three
+                        memory accesses, but 256 KB even when nearly empty */
+    FIB_SMALL,       /* up to FIB_SMALL_MAX entries compared all at once with
+                        SIMD instructions (as FIB_LINEAR beyond that) */
+    FIB_AUTO,        /* FIB_SMALL up to FIB_SMALL_MAX entries, else FIB_TRIE */
+    FIB_BLOOM        /* a hash table per prefix length, probed longest first
+                        and only where the length's Bloom filter says the
+                        prefix may be in it */
+} fib_backend_t;
+
+typedef struct fib_t fib_t;
+
+/** Creates an empty FIB using the specified backend. */
+fib_t* fib_create(fib_backend_t backend);
+
+/** Frees the FIB. */
+void fib_destroy(fib_t* fib);
+
+/**
+ * Replaces the contents of the FIB with the n entries (which are copied).  If
+ * several entries share a prefix and mask, only one of them is kept.  Returns
+ * 0, or -1 if out of memory, in which case the FIB keeps its previous contents.
+ */
+int fib_load(fib_t* fib, const fib_entry_t* entries, unsigned n);
+
+/**
+ * Replaces the n entries (in place) with the smallest set of prefixes which
+ * leads every address to the same next hop under longest prefix matching (the
+ * ORTC algorithm of Draves et al.).  Addresses no entry matched may be covered
+ * by a shorter prefix now, so entries with a dst_ip of 0xFFFFFFFF are added to
+ * keep them unmatched; fib_lookup treats those as a miss.  Returns the new
+ * number of entries (at most n), or -1 (leaving the entries as they were) if
+ * out of memory.
+ */
+int fib_compress(fib_entry_t* entries, unsigned n);
+
+/**
+ * Returns the next hop of the longest prefix matching the (network-byte order)
+ * ip.  If no prefix matches, the dst_ip of the result is 0xFFFFFFFF.
+ */
+next_hop_t fib_lookup(const fib_t* fib, uint32_t ip);
+
+/** Returns the number of prefixes in the FIB. */
+unsigned fib_size(const fib_t* fib);
+
+/** Returns the number of bytes of memory held by the FIB. */
+size_t fib_memory(const fib_t* fib);
+
+/** Returns the name of the backend, e.g. "linear". */
+const char* fib_backend_name(fib_backend_t backend);
+
+#endif /* _DR_FIB_H_ */
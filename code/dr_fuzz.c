@@ -0,0 +1,345 @@
+/*
+ * Filename: dr_fuzz.c
+ * Purpose:  Fuzz driver for the Dynamic Routing library.
+ *
+ * Each input is a script for a fresh router with four interfaces (10.0.I.1/24,
+ * I = 0..3) running on the virtual clock.  Its bytes are taken as operations,
+ * one after the other, until they run out:
+ *
+ *   0  raw packet      -- INTF SRC LEN_HI LEN_LO, then LEN (below 1024) bytes,
+ *                         or fewer if the input ends, handed to
+ *                         dr_handle_packet as they are
+ *   1  advertisement   -- INTF SRC COUNT, then COUNT entries of PREFIX LENGTH
+ *                         METRIC bytes (for 10.PREFIX.4.0/LENGTH, masked, and
+ *                         metrics up to 17, so also invalid ones)
+ *   2  interface flip  -- INTF; enables or disables it (dr_interface_changed)
+ *   3  interface cost  -- INTF COST; sets its cost to 1..16
+ *   4  tick            -- TENTHS; advances the clock and calls dr_handle_periodic
+ *   5  configuration   -- BITS; aggregation, FIB compression, route limits and
+ *                         rate limits on or off
+ *   6  lookup          -- four bytes of an address for dr_get_next_hop
+ *   7  repeat          -- INTF SRC; the last advertisement (operation 1) again,
+ *                         from that neighbour
+ *
+ * Every operation byte is taken modulo 8 and every operand modulo its range, so
+ * any input is a valid script.  The packets come from 10.0.INTF.(2 + SRC % 4).
+ * The library is built with DR_CHECK_INVARIANTS, so its table is verified after
+ * every call, and every advertisement the router sends is checked here.  The
+ * first advertisement of each neighbour after aggregation was turned on or off
+ * must be merged, not skipped as a repeat of one merged under the old setting.
+ * The route limits are only set when they change, since setting them is
+ * enough to have every advertisement merged again.
+ *
+ * With libFuzzer (-DDR_FUZZ_LIBFUZZER) LLVMFuzzerTestOneInput is the entry
+ * point.  Otherwise each file named on the command line (or stdin) is run once,
+ * which suits AFL (dr_fuzz @@) and the reproduction of crashes, and with
+ * -n RUNS that many random inputs are run instead (-S SEED).
+ *
+ * Usage: dr_fuzz [-n RUNS] [-S SEED] [FILE...]
+ */
+
+#include <arpa/inet.h>
+#include <assert.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "dr_api.h"
+#include "dr_clock.h"
+
+#define FUZZ_INTFS      4
+#define FUZZ_MAX_INPUT  (1 << 16)
+#define RIP_INFINITY    16
+
+/** a RIP entry as the library sends and receives it (see rip_entry_t in dr_api.c) */
+typedef struct fuzz_entry_t {
+    uint16_t addr_family;
+    uint16_t pad;
+    uint32_t ip;
+    uint32_t subnet_mask;
+    uint32_t next_hop;
+    uint32_t metric;            /* in host-byte order */
+} __attribute__ ((packed)) fuzz_entry_t;
+
+static lvns_interface_t intfs[FUZZ_INTFS];
+
+/** the router's settings, and which neighbours (by interface and 10.0.I.(2 + N))
+    have not been heard since aggregation was turned on or off */
+static int aggregate;
+static dr_route_limits_t limits;
+static bool toggled[FUZZ_INTFS][4];
+
+/** the last advertisement made by operation 1 (a copy of what the router got) */
+static fuzz_entry_t last_entries[64];
+static unsigned last_count;
+
+/** the input being run, and how much of it is left */
+static const uint8_t *input;
+static size_t input_left;
+
+static void die(const char *msg, const char *arg) {
+    fprintf(stderr, "dr_fuzz: %s%s%s\n", msg, arg ? ": " : "", arg ? arg : "");
+    exit(1);
+}
+
+/** the next byte of the input (0 once it ran out) */
+static uint8_t take() {
+    if (input_left == 0)
+        return 0;
+    input_left--;
+    return *input++;
+}
+
+/* ******************************** host ******************************** */
+
+static unsigned cb_interface_count(void *user) {
+    return FUZZ_INTFS;
+}
+
+static lvns_interface_t cb_get_interface(void *user, unsigned index) {
+    lvns_interface_t none;
+    if (index < FUZZ_INTFS)
+        return intfs[index];
+    memset(&none, 0, sizeof(none));
+    return none;
+}
+
+/* whatever it was fed, the router must only send well-formed advertisements */
+static void cb_send_payload(void *user, uint32_t dst_ip, uint32_t next_hop_ip, uint32_t outgoing_intf,
+                            char *buf, unsigned len) {
+    assert(outgoing_intf < FUZZ_INTFS);
+    assert(len % sizeof(fuzz_entry_t) == 0);
+    for (unsigned i = 0; i < len / sizeof(fuzz_entry_t); i++) {
+        fuzz_entry_t entry;
+        memcpy(&entry, buf + i * sizeof(entry), sizeof(entry));
+        uint32_t mask = ntohl(entry.subnet_mask);
+        assert(entry.addr_family == htons(AF_INET));
+        assert(entry.metric <= RIP_INFINITY);
+        assert((~mask & (~mask + 1)) == 0); /* contiguous */
+        assert((entry.ip & entry.subnet_mask) == entry.ip);
+    }
+}
+
+/* ****************************** operations ****************************** */
+
+static uint32_t neighbour_ip(unsigned intf, unsigned src) {
+    return htonl(0x0A000000 | intf << 8 | (2 + src % 4));
+}
+
+static void raw_packet(dr_router_t *router) {
+    unsigned intf = take() % (FUZZ_INTFS + 1); /* one past the last, too */
+    unsigned src = take();
+    uint32_t ip = neighbour_ip(intf, src);
+    unsigned len = take() << 8;
+    len = (len | take()) % 1024;
+    if (len > input_left)
+        len = input_left;
+
+    /* a buffer of exactly len bytes, so that reading past it is caught */
+    char *buf = (char *) malloc(len ? len : 1);
+    if (buf == NULL)
+        die("out of memory", NULL);
+    memcpy(buf, input, len);
+    input += len;
+    input_left -= len;
+    dr_router_handle_packet(router, ip, intf, len ? buf : NULL, len);
+    free(buf);
+    if (intf < FUZZ_INTFS)
+        toggled[intf][src % 4] = false; /* whether it was merged is not known */
+}
+
+/* hands the entries to the router from neighbour src on intf */
+static void advertise(dr_router_t *router, unsigned intf, unsigned src, fuzz_entry_t *entries, unsigned count) {
+    dr_stats_t before, after;
+    uint32_t ip = neighbour_ip(intf, src);
+
+    dr_router_get_stats(router, &before);
+    dr_router_handle_packet(router, ip, intf, count ? (char *) entries : NULL,
+                            count * sizeof(fuzz_entry_t));
+    dr_router_get_stats(router, &after);
+
+    if (toggled[intf][src % 4])
+        assert(after.intf[intf].adverts_unchanged == before.intf[intf].adverts_unchanged);
+    toggled[intf][src % 4] = false;
+}
+
+static void advertisement(dr_router_t *router) {
+    fuzz_entry_t entries[64];
+    unsigned intf = take() % FUZZ_INTFS;
+    unsigned src = take();
+    unsigned count = take() % 65;
+
+    for (unsigned i = 0; i < count; i++) {
+        uint8_t prefix = take();
+        unsigned length = take() % 33;
+        uint32_t mask = length ? 0xFFFFFFFFu << (32 - length) : 0;
+        entries[i].addr_family = htons(AF_INET);
+        entries[i].pad = 0;
+        entries[i].ip = htonl((0x0A000400 | prefix << 16) & mask);
+        entries[i].subnet_mask = htonl(mask);
+        entries[i].next_hop = 0;
+        entries[i].metric = take() % (RIP_INFINITY + 2);
+    }
+    memcpy(last_entries, entries, count * sizeof(fuzz_entry_t));
+    last_count = count;
+    advertise(router, intf, src, entries, count);
+}
+
+static void repeat(dr_router_t *router) {
+    unsigned intf = take() % FUZZ_INTFS;
+    unsigned src = take();
+    fuzz_entry_t entries[64];
+
+    memcpy(entries, last_entries, last_count * sizeof(fuzz_entry_t));
+    advertise(router, intf, src, entries, last_count);
+}
+
+static void interface_flip(dr_router_t *router) {
+    unsigned intf = take() % FUZZ_INTFS;
+    intfs[intf].enabled = !intfs[intf].enabled;
+    dr_router_interface_changed(router, intf, 1, 0);
+}
+
+static void interface_cost(dr_router_t *router) {
+    unsigned intf = take() % FUZZ_INTFS;
+    intfs[intf].cost = 1 + take() % RIP_INFINITY;
+    dr_router_interface_changed(router, intf, 0, 1);
+}
+
+static void tick(dr_router_t *router) {
+    dr_clock_advance(100L * take());
+    dr_router_handle_periodic(router);
+}
+
+static void configure(dr_router_t *router) {
+    uint8_t bits = take();
+    dr_route_limits_t new_limits;
+    dr_rate_limit_t rate_limit;
+
+    if ((bits & 1) != aggregate) {
+        aggregate = bits & 1;
+        memset(toggled, 1, sizeof(toggled));
+    }
+    dr_router_set_aggregation(router, aggregate);
+    dr_router_set_fib_compression(router, bits & 2);
+    new_limits.max_routes = bits & 4 ? 12 : 0;
+    new_limits.max_neighbour_routes = bits & 8 ? 6 : 0;
+    new_limits.policy = bits & 16 ? DR_OVERFLOW_PREFER_SHORT : DR_OVERFLOW_REJECT;
+    if (memcmp(&new_limits, &limits, sizeof(limits)) != 0) {
+        limits = new_limits;
+        dr_router_set_route_limits(router, &limits);
+    }
+    rate_limit.rate = bits & 32 ? 2 : 0;
+    rate_limit.burst = 2;
+    rate_limit.policy = bits & 64 ? DR_RATE_DEFER : DR_RATE_DROP;
+    dr_router_set_rate_limit(router, &rate_limit);
+}
+
+static void lookup(dr_router_t *router) {
+    uint32_t ip = 0;
+    for (int i = 0; i < 4; i++)
+        ip = ip << 8 | take();
+    next_hop_t hop = dr_router_get_next_hop(router, htonl(ip));
+    assert(hop.dst_ip == 0xFFFFFFFF || hop.interface < FUZZ_INTFS);
+}
+
+/* runs one input on a fresh router */
+static void run(const uint8_t *data, size_t size) {
+    dr_host_t host;
+
+    for (unsigned i = 0; i < FUZZ_INTFS; i++) {
+        intfs[i].ip = htonl(0x0A000001 | i << 8);
+        intfs[i].subnet_mask = htonl(0xFFFFFF00);
+        intfs[i].enabled = 1;
+        intfs[i].cost = 1;
+    }
+    input = data;
+    input_left = size;
+    aggregate = 0;
+    memset(&limits, 0, sizeof(limits));
+    memset(toggled, 0, sizeof(toggled));
+    last_count = 0;
+
+    dr_clock_use_virtual(0);
+    host.interface_count = cb_interface_count;
+    host.get_interface = cb_get_interface;
+    host.send_payload = cb_send_payload;
+    host.user = NULL;
+    dr_router_t *router = dr_router_create(&host);
+    if (router == NULL)
+        die("cannot create router", NULL);
+
+    while (input_left > 0) {
+        switch (take() % 8) {
+        case 0: raw_packet(router); break;
+        case 1: advertisement(router); break;
+        case 2: interface_flip(router); break;
+        case 3: interface_cost(router); break;
+        case 4: tick(router); break;
+        case 5: configure(router); break;
+        case 6: lookup(router); break;
+        case 7: repeat(router); break;
+        }
+    }
+    dr_router_destroy(router);
+}
+
+extern "C" int LLVMFuzzerTestOneInput(const uint8_t *data, size_t size) {
+    run(data, size);
+    return 0;
+}
+
+#ifndef DR_FUZZ_LIBFUZZER
+/* runs the contents of f */
+static void run_file(FILE *f, const char *name) {
+    static uint8_t data[FUZZ_MAX_INPUT];
+    size_t size = fread(data, 1, sizeof(data), f);
+    if (ferror(f))
+        die("cannot read", name);
+    run(data, size);
+}
+
+int main(int argc, char **argv) {
+    unsigned long runs = 0;
+    unsigned seed = 1;
+    int c;
+
+    while ((c = getopt(argc, argv, "n:S:")) != -1) {
+        switch (c) {
+        case 'n': runs = strtoul(optarg, NULL, 10); break;
+        case 'S': seed = (unsigned) strtoul(optarg, NULL, 10); break;
+        default:
+            fprintf(stderr, "usage: dr_fuzz [-n RUNS] [-S SEED] [FILE...]\n");
+            return 1;
+        }
+    }
+
+    if (runs > 0) {
+        static uint8_t data[4096];
+        srand(seed);
+        for (unsigned long i = 0; i < runs; i++) {
+            size_t size = rand() % sizeof(data);
+            for (size_t j = 0; j < size; j++)
+                data[j] = (uint8_t) rand();
+            run(data, size);
+        }
+        printf("{\"runs\":%lu,\"seed\":%u}\n", runs, seed);
+        return 0;
+    }
+
+    if (optind == argc) {
+        run_file(stdin, "stdin");
+        return 0;
+    }
+    for (int i = optind; i < argc; i++) {
+        FILE *f = fopen(argv[i], "rb");
+        if (f == NULL)
+            die("cannot open", argv[i]);
+        run_file(f, argv[i]);
+        fclose(f);
+    }
+    return 0;
+}
+#endif
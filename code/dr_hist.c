@@ -0,0 +1,82 @@
+/* Filename: dr_hist.c */
+
+#include <pthread.h>
+#include <time.h>
+
+#include "dr_hist.h"
+
+static pthread_once_t calibrate_once = PTHREAD_ONCE_INIT;
+static double ticks_per_ns = 1.0;
+
+static void calibrate() {
+    struct timespec t0, t1, pause;
+
+    pause.tv_sec = 0;
+    pause.tv_nsec = 5000000;
+    clock_gettime(CLOCK_MONOTONIC, &t0);
+    uint64_t c0 = dr_hist_ticks();
+    nanosleep(&pause, NULL);
+    clock_gettime(CLOCK_MONOTONIC, &t1);
+    uint64_t c1 = dr_hist_ticks();
+
+    double ns = (t1.tv_sec - t0.tv_sec) * 1e9 + (t1.tv_nsec - t0.tv_nsec);
+    if (ns > 0 && c1 > c0)
+        ticks_per_ns = (c1 - c0) / ns;
+}
+
+double dr_hist_ticks_per_ns() {
+    pthread_once(&calibrate_once, calibrate);
+    return ticks_per_ns;
+}
+
+/* the bucket of a value: linear below DR_HIST_SUB_BUCKETS, log-linear above */
+static unsigned bucket_of(uint64_t v) {
+    if (v < DR_HIST_SUB_BUCKETS)
+        return (unsigned) v;
+    if (v >> DR_HIST_MAX_BITS)
+        return DR_HIST_BUCKETS - 1;
+
+    unsigned e = 63 - __builtin_clzll(v);
+    return (e - DR_HIST_SUB_BITS + 1) * DR_HIST_SUB_BUCKETS +
+           (unsigned) ((v >> (e - DR_HIST_SUB_BITS)) & (DR_HIST_SUB_BUCKETS - 1));
+}
+
+/* the largest value which falls into a bucket */
+static uint64_t bucket_top(unsigned i) {
+    if (i < DR_HIST_SUB_BUCKETS)
+        return i;
+
+    unsigned e = i / DR_HIST_SUB_BUCKETS + DR_HIST_SUB_BITS - 1;
+    uint64_t sub = i % DR_HIST_SUB_BUCKETS;
+    return ((DR_HIST_SUB_BUCKETS + sub + 1) << (e - DR_HIST_SUB_BITS)) - 1;
+}
+
+void dr_hist_record(dr_hist_t* hist, uint64_t ticks) {
+    __atomic_add_fetch(&hist->buckets[bucket_of(ticks)], 1, __ATOMIC_RELAXED);
+    __atomic_add_fetch(&hist->count, 1, __ATOMIC_RELAXED);
+
+    uint64_t max = __atomic_load_n(&hist->max, __ATOMIC_RELAXED);
+    while (ticks > max &&
+           !__atomic_compare_exchange_n(&hist->max, &max, ticks, true, __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+        ;
+}
+
+uint64_t dr_hist_percentile(const dr_hist_t* hist, double q) {
+    uint64_t count = __atomic_load_n(&hist->count, __ATOMIC_RELAXED);
+    uint64_t max = __atomic_load_n(&hist->max, __ATOMIC_RELAXED);
+    if (count == 0)
+        return 0;
+
+    /* the rank of the value we are after, counting from 1 */
+    uint64_t rank = (uint64_t) (q * count + 0.5);
+    if (rank < 1)
+        rank = 1;
+
+    uint64_t seen = 0;
+    for (unsigned i = 0; i < DR_HIST_BUCKETS; i++) {
+        seen += __atomic_load_n(&hist->buckets[i], __ATOMIC_RELAXED);
+        if (seen >= rank)
+            return bucket_top(i) < max ? bucket_top(i) : max;
+    }
+    return max;
+}
@@ -0,0 +1,59 @@
+/*
+ * Filename: dr_hist.h
+ * Purpose:  Low-overhead latency histograms.  Durations are taken from the CPU
+ *           time stamp counter where there is one and recorded into
+ *           log-linear buckets (in the style of HdrHistogram): each power of
+ *           two is split into DR_HIST_SUB_BUCKETS linear sub-buckets, so any
+ *           recorded value is reported with a relative error of at most
+ *           1 / DR_HIST_SUB_BUCKETS.
+ */
+
+#ifndef _DR_HIST_H_
+#define _DR_HIST_H_
+
+#include <stdint.h>
+#include <time.h>
+
+/** linear sub-buckets per power of two (a power of two itself) */
+#define DR_HIST_SUB_BITS    3
+#define DR_HIST_SUB_BUCKETS (1 << DR_HIST_SUB_BITS)
+
+/** durations of 2^DR_HIST_MAX_BITS ticks or more land in the last bucket */
+#define DR_HIST_MAX_BITS    40
+
+#define DR_HIST_BUCKETS ((DR_HIST_MAX_BITS - DR_HIST_SUB_BITS + 1) * DR_HIST_SUB_BUCKETS)
+
+/** a histogram of durations in ticks; zero-initialized it is empty */
+typedef struct dr_hist_t {
+    uint64_t count;
+    uint64_t max;
+    uint64_t buckets[DR_HIST_BUCKETS];
+} dr_hist_t;
+
+/** Returns the current value of the tick counter (the TSC on x86). */
+static inline uint64_t dr_hist_ticks() {
+#if defined(__x86_64__) || defined(__i386__)
+    return __builtin_ia32_rdtsc();
+#else
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000000000 + ts.tv_nsec;
+#endif
+}
+
+/**
+ * Measures how many ticks pass per nanosecond.  This takes a few milliseconds
+ * the first time it is called; every later call returns the same value.
+ */
+double dr_hist_ticks_per_ns();
+
+/** Records a duration (in ticks).  Safe to call from several threads at once. */
+void dr_hist_record(dr_hist_t* hist, uint64_t ticks);
+
+/**
+ * Returns the duration (in ticks) below which the fraction q (0 to 1) of the
+ * recorded durations lie, or 0 if the histogram is empty.
+ */
+uint64_t dr_hist_percentile(const dr_hist_t* hist, double q);
+
+#endif /* _DR_HIST_H_ */
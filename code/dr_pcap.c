@@ -0,0 +1,323 @@
+/* Filename: dr_pcap.c */
+
+#include <arpa/inet.h>  /* htons, ... */
+#include <errno.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "dr_alloc.h"
+#include "dr_clock.h"
+#include "dr_pcap.h"
+
+/** packets are gathered in two buffers of this size: one is filled while the
+    writer writes the other */
+#define PCAP_BUFFER_SIZE (1 << 20)
+
+/** the writer writes out what has been gathered at least this often */
+#define PCAP_FLUSH_SECS 1
+
+#define PCAP_MAGIC        0xa1b2c3d4u  /* time stamps in microseconds */
+#define PCAP_LINKTYPE_RAW 101          /* packets start with the IP header */
+#define PCAP_SNAPLEN      65535
+
+#define RIP_PORT          520
+#define RIP_ENTRY_SIZE    20           /* see rip_entry_t in dr_api.c */
+#define RIP_METRIC_OFFSET 16
+
+/** the pcap file header */
+typedef struct pcap_file_header_t {
+    uint32_t magic;
+    uint16_t version_major;
+    uint16_t version_minor;
+    int32_t thiszone;
+    uint32_t sigfigs;
+    uint32_t snaplen;
+    uint32_t linktype;
+} pcap_file_header_t;
+
+/** the header of each packet in a pcap file */
+typedef struct pcap_record_t {
+    uint32_t ts_sec;
+    uint32_t ts_usec;
+    uint32_t incl_len;
+    uint32_t orig_len;
+} pcap_record_t;
+
+typedef struct ipv4_header_t {
+    uint8_t version_ihl;
+    uint8_t tos;
+    uint16_t total_len;
+    uint16_t id;
+    uint16_t frag;
+    uint8_t ttl;
+    uint8_t protocol;
+    uint16_t checksum;
+    uint32_t src;
+    uint32_t dst;
+} ipv4_header_t;
+
+typedef struct udp_header_t {
+    uint16_t src_port;
+    uint16_t dst_port;
+    uint16_t len;
+    uint16_t checksum;
+} udp_header_t;
+
+typedef struct rip_header_t {
+    uint8_t command;
+    uint8_t version;
+    uint16_t zero;
+} rip_header_t;
+
+/** what precedes the payload of each packet in the buffers and the file */
+typedef struct packet_head_t {
+    pcap_record_t record;
+    ipv4_header_t ip;
+    udp_header_t udp;
+    rip_header_t rip;
+} packet_head_t;
+
+/** the most payload one datagram takes, in whole entries */
+#define PCAP_MAX_PAYLOAD \
+    ((0xFFFF - sizeof(ipv4_header_t) - sizeof(udp_header_t) - sizeof(rip_header_t)) / RIP_ENTRY_SIZE * RIP_ENTRY_SIZE)
+
+struct dr_pcap_t {
+    FILE* file;
+    pthread_t writer;
+    pthread_mutex_t lock;
+    pthread_cond_t wake;    /* signalled when pending is set or stopping */
+
+    /* all of the following are kept under lock */
+    char* fill;             /* the buffer packets are appended to */
+    size_t fill_len;
+    char* pending;          /* a full buffer handed to the writer, if any */
+    size_t pending_len;
+    char* spare;            /* the other buffer, or NULL while the writer has it */
+    uint16_t ip_id;
+    uint64_t dropped;
+    bool stopping;
+};
+
+/* adds the big-endian 16-bit words of data to sum */
+static uint32_t sum_words(uint32_t sum, const uint8_t* data, size_t len) {
+    for (size_t i = 0; i + 1 < len; i += 2)
+        sum += (data[i] << 8) | data[i + 1];
+    if (len & 1)
+        sum += data[len - 1] << 8;
+    return sum;
+}
+
+/* returns the ones' complement of the folded sum, in network-byte order */
+static uint16_t checksum(uint32_t sum) {
+    while (sum >> 16)
+        sum = (sum & 0xFFFF) + (sum >> 16);
+    return htons((uint16_t) ~sum);
+}
+
+/* turns the packets of a buffer into what goes on the wire: puts the metrics
+   in network-byte order and fills in the checksums */
+static void finish_packets(char* buffer, size_t len) {
+    size_t offset = 0;
+    while (offset < len) {
+        packet_head_t head;
+        memcpy(&head, buffer + offset, sizeof(head));
+        uint8_t* payload = (uint8_t*) buffer + offset + sizeof(head);
+        size_t payload_len = head.record.incl_len - (sizeof(head) - sizeof(head.record));
+
+        for (size_t i = 0; i + RIP_ENTRY_SIZE <= payload_len; i += RIP_ENTRY_SIZE) {
+            uint32_t metric;
+            memcpy(&metric, payload + i + RIP_METRIC_OFFSET, sizeof(metric));
+            metric = htonl(metric);
+            memcpy(payload + i + RIP_METRIC_OFFSET, &metric, sizeof(metric));
+        }
+
+        head.ip.checksum = checksum(sum_words(0, (const uint8_t*) &head.ip, sizeof(head.ip)));
+
+        /* the pseudo header: source, destination, protocol and UDP length */
+        uint32_t sum = sum_words(0, (const uint8_t*) &head.ip.src, 2 * sizeof(uint32_t));
+        sum += head.ip.protocol + ntohs(head.udp.len);
+        sum = sum_words(sum, (const uint8_t*) &head.udp, sizeof(head.udp) + sizeof(head.rip));
+        sum = sum_words(sum, payload, payload_len);
+        head.udp.checksum = checksum(sum);
+        if (head.udp.checksum == 0)
+            head.udp.checksum = 0xFFFF;
+
+        memcpy(buffer + offset, &head, sizeof(head));
+        offset += sizeof(head) + payload_len;
+    }
+}
+
+/* gives the buffer being filled to the writer; the spare one must be free */
+static void hand_over(dr_pcap_t* pcap) {
+    pcap->pending = pcap->fill;
+    pcap->pending_len = pcap->fill_len;
+    pcap->fill = pcap->spare;
+    pcap->fill_len = 0;
+    pcap->spare = NULL;
+    pthread_cond_signal(&pcap->wake);
+}
+
+static void* writer_main(void* arg) {
+    dr_pcap_t* pcap = (dr_pcap_t*) arg;
+
+    pthread_mutex_lock(&pcap->lock);
+    for (;;) {
+        while (pcap->pending == NULL && !pcap->stopping) {
+            struct timespec deadline;
+            clock_gettime(CLOCK_REALTIME, &deadline);
+            deadline.tv_sec += PCAP_FLUSH_SECS;
+            if (pthread_cond_timedwait(&pcap->wake, &pcap->lock, &deadline) == ETIMEDOUT &&
+                pcap->pending == NULL && pcap->fill_len > 0)
+                hand_over(pcap); /* so the file keeps up with a quiet router */
+        }
+        if (pcap->pending == NULL) {
+            /* stopping: write out whatever is left */
+            if (pcap->fill_len == 0)
+                break;
+            hand_over(pcap);
+        }
+
+        char* buffer = pcap->pending;
+        size_t len = pcap->pending_len;
+        pcap->pending = NULL;
+        pthread_mutex_unlock(&pcap->lock);
+
+        finish_packets(buffer, len);
+        fwrite(buffer, 1, len, pcap->file);
+        fflush(pcap->file);
+
+        pthread_mutex_lock(&pcap->lock);
+        pcap->spare = buffer;
+    }
+    pthread_mutex_unlock(&pcap->lock);
+    return NULL;
+}
+
+dr_pcap_t* dr_pcap_open(const char* path) {
+    dr_pcap_t* pcap = (dr_pcap_t*) dr_calloc(1, sizeof(dr_pcap_t));
+    if (pcap == NULL)
+        return NULL;
+    pcap->fill = (char*) dr_malloc(PCAP_BUFFER_SIZE);
+    pcap->spare = (char*) dr_malloc(PCAP_BUFFER_SIZE);
+    pcap->file = fopen(path, "wb");
+    if (pcap->fill == NULL || pcap->spare == NULL || pcap->file == NULL)
+        goto fail;
+
+    pcap_file_header_t header;
+    header.magic = PCAP_MAGIC;
+    header.version_major = 2;
+    header.version_minor = 4;
+    header.thiszone = 0;
+    header.sigfigs = 0;
+    header.snaplen = PCAP_SNAPLEN;
+    header.linktype = PCAP_LINKTYPE_RAW;
+    if (fwrite(&header, sizeof(header), 1, pcap->file) != 1)
+        goto fail;
+    fflush(pcap->file);
+
+    pthread_mutex_init(&pcap->lock, NULL);
+    pthread_cond_init(&pcap->wake, NULL);
+    if (pthread_create(&pcap->writer, NULL, writer_main, pcap) != 0) {
+        pthread_cond_destroy(&pcap->wake);
+        pthread_mutex_destroy(&pcap->lock);
+        goto fail;
+    }
+    return pcap;
+
+fail:
+    if (pcap->file != NULL)
+        fclose(pcap->file);
+    free(pcap->fill);
+    free(pcap->spare);
+    free(pcap);
+    return NULL;
+}
+
+/* appends one datagram of at most PCAP_MAX_PAYLOAD bytes; called under lock */
+static void append_packet(dr_pcap_t* pcap, const pcap_record_t* stamp, uint32_t src_ip, uint32_t dst_ip,
+                          const char* payload, size_t len) {
+    size_t size = sizeof(packet_head_t) + len;
+    if (pcap->fill_len + size > PCAP_BUFFER_SIZE) {
+        if (pcap->spare == NULL) {
+            pcap->dropped++; /* the writer is still busy with the other buffer */
+            return;
+        }
+        hand_over(pcap);
+    }
+
+    packet_head_t head;
+    memset(&head, 0, sizeof(head));
+    head.record.ts_sec = stamp->ts_sec;
+    head.record.ts_usec = stamp->ts_usec;
+    head.record.incl_len = (uint32_t) (size - sizeof(head.record));
+    head.record.orig_len = head.record.incl_len;
+    head.ip.version_ihl = 0x45;
+    head.ip.tos = 0xC0; /* internetwork control, as routers send their updates */
+    head.ip.total_len = htons((uint16_t) head.record.incl_len);
+    head.ip.id = htons(pcap->ip_id++);
+    head.ip.ttl = 1;
+    head.ip.protocol = IPPROTO_UDP;
+    head.ip.src = src_ip;
+    head.ip.dst = dst_ip;
+    head.udp.src_port = htons(RIP_PORT);
+    head.udp.dst_port = htons(RIP_PORT);
+    head.udp.len = htons((uint16_t) (sizeof(head.udp) + sizeof(head.rip) + len));
+    head.rip.command = 2; /* response */
+    head.rip.version = 2;
+
+    memcpy(pcap->fill + pcap->fill_len, &head, sizeof(head));
+    if (len > 0)
+        memcpy(pcap->fill + pcap->fill_len + sizeof(head), payload, len);
+    pcap->fill_len += size;
+}
+
+void dr_pcap_write(dr_pcap_t* pcap, uint32_t src_ip, uint32_t dst_ip, const void* payload, size_t len) {
+    pcap_record_t stamp;
+    if (dr_clock_is_virtual()) {
+        long now = dr_clock_now();
+        stamp.ts_sec = (uint32_t) (now / 1000);
+        stamp.ts_usec = (uint32_t) (now % 1000 * 1000);
+    } else {
+        struct timespec now;
+        clock_gettime(CLOCK_REALTIME, &now);
+        stamp.ts_sec = (uint32_t) now.tv_sec;
+        stamp.ts_usec = (uint32_t) (now.tv_nsec / 1000);
+    }
+
+    const char* data = (const char*) payload;
+    pthread_mutex_lock(&pcap->lock);
+    do {
+        size_t part = len < PCAP_MAX_PAYLOAD ? len : PCAP_MAX_PAYLOAD;
+        append_packet(pcap, &stamp, src_ip, dst_ip, data, part);
+        data += part;
+        len -= part;
+    } while (len > 0);
+    pthread_mutex_unlock(&pcap->lock);
+}
+
+uint64_t dr_pcap_dropped(dr_pcap_t* pcap) {
+    pthread_mutex_lock(&pcap->lock);
+    uint64_t dropped = pcap->dropped;
+    pthread_mutex_unlock(&pcap->lock);
+    return dropped;
+}
+
+void dr_pcap_close(dr_pcap_t* pcap) {
+    if (pcap == NULL)
+        return;
+    pthread_mutex_lock(&pcap->lock);
+    pcap->stopping = true;
+    pthread_cond_signal(&pcap->wake);
+    pthread_mutex_unlock(&pcap->lock);
+    pthread_join(pcap->writer, NULL);
+
+    fclose(pcap->file);
+    pthread_cond_destroy(&pcap->wake);
+    pthread_mutex_destroy(&pcap->lock);
+    free(pcap->fill);
+    free(pcap->spare);
+    free(pcap);
+}
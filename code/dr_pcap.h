@@ -0,0 +1,38 @@
+/*
+ * Filename: dr_pcap.h
+ * Purpose:  pcap files of the RIP traffic of a router: every advertisement,
+ *           wrapped in the IPv4, UDP and RIPv2 headers it would have on the
+ *           wire, so Wireshark or tshark can take it apart.
+ */
+
+#ifndef _DR_PCAP_H_
+#define _DR_PCAP_H_
+
+#include <stddef.h>  /* size_t */
+#include <stdint.h>
+
+typedef struct dr_pcap_t dr_pcap_t;
+
+/**
+ * Creates (or truncates) the pcap file at path, writes its header and starts
+ * the thread which writes the packets to it.  Returns NULL on failure.
+ */
+dr_pcap_t* dr_pcap_open(const char* path);
+
+/**
+ * Appends the advertisement payload (len bytes of RIP entries as the library
+ * sends them, i.e. without a RIP header and with the metric in host-byte
+ * order) from src_ip to dst_ip (network-byte order), time stamped now.  It is
+ * only copied to a buffer: the headers are completed and written by the
+ * writer thread.  If both buffers are full, the packet is dropped instead of
+ * waiting for the writer.  Payloads too large for one datagram are split.
+ */
+void dr_pcap_write(dr_pcap_t* pcap, uint32_t src_ip, uint32_t dst_ip, const void* payload, size_t len);
+
+/** Returns how many packets have been dropped because the writer fell behind. */
+uint64_t dr_pcap_dropped(dr_pcap_t* pcap);
+
+/** Writes out what is buffered, stops the writer and closes the file. */
+void dr_pcap_close(dr_pcap_t* pcap);
+
+#endif /* _DR_PCAP_H_ */
@@ -0,0 +1,283 @@
+/*
+ * Filename: dr_replay.c
+ * Purpose:  Replays a capture file (see dr_capture in dr_api.h) into a fresh
+ *           router of the Dynamic Routing library.
+ *
+ * The router is created with the interfaces the capture started with, and gets
+ * every recorded call in order, on the virtual clock set to the recorded time,
+ * so it goes through the same timeouts as the router which was recorded.  By
+ * default the calls are made as fast as possible; with -t they are spaced out
+ * as they were recorded.  For each run (-n RUNS, default 1) one JSON object is
+ * written:
+ *
+ *   capture, records, packets, periodic, changes (calls of each kind), span_ms
+ *   (recorded time from the first record to the last), wall_ms, calls_per_s,
+ *   sent (advertisements the router sent), sent_digest (a fingerprint of all
+ *   of them, which is the same on every run), routes (in the table at the end)
+ *   and lookups (-l).
+ *
+ * With -v every change of the usable routes is written as it happens:
+ *
+ *   TIME_MS add|modify|withdraw PREFIX/LENGTH via NEXT_HOP intf N cost C
+ *
+ * With -l every interface address is looked up after each call, and with -T the
+ * latencies of the entry points are written at the end (see dr_dump_timing).
+ *
+ * Usage: dr_replay [-t] [-v] [-l] [-T] [-n RUNS] CAPTURE
+ */
+
+#include <arpa/inet.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "dr_api.h"
+#include "dr_capture.h"
+#include "dr_clock.h"
+
+/** the interfaces of the replayed router, as last recorded */
+static lvns_interface_t *intfs;
+static unsigned intf_count;
+
+static int timed;
+static int verbose;
+static int lookups;
+static int dump_timing;
+
+static long now_ms;
+static uint64_t sent;
+static uint64_t sent_digest;
+static uint64_t lookups_done;
+
+static void die(const char *msg, const char *arg) {
+    fprintf(stderr, "dr_replay: %s%s%s\n", msg, arg ? ": " : "", arg ? arg : "");
+    exit(1);
+}
+
+static double wall_ms() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000.0 + ts.tv_nsec / 1000000.0;
+}
+
+/** folds the bytes into a 64-bit FNV-1a hash */
+static uint64_t fnv1a(uint64_t h, const void *data, unsigned len) {
+    const unsigned char *bytes = (const unsigned char *) data;
+    for (unsigned i = 0; i < len; i++) {
+        h ^= bytes[i];
+        h *= 1099511628211ULL;
+    }
+    return h;
+}
+
+/* ******************************** host ******************************** */
+
+static unsigned cb_interface_count(void *user) {
+    return intf_count;
+}
+
+static lvns_interface_t cb_get_interface(void *user, unsigned index) {
+    lvns_interface_t none;
+    if (index < intf_count)
+        return intfs[index];
+    memset(&none, 0, sizeof(none));
+    return none;
+}
+
+static void cb_send_payload(void *user, uint32_t dst_ip, uint32_t next_hop_ip, uint32_t outgoing_intf,
+                            char *buf, unsigned len) {
+    sent++;
+    sent_digest = fnv1a(sent_digest, &outgoing_intf, sizeof(outgoing_intf));
+    sent_digest = fnv1a(sent_digest, buf, len);
+}
+
+static void print_route(void *user, dr_route_event_t event, const dr_route_t *route) {
+    static const char *names[] = { "add", "modify", "withdraw" };
+    struct in_addr prefix, hop;
+    char prefix_text[INET_ADDRSTRLEN], hop_text[INET_ADDRSTRLEN];
+
+    prefix.s_addr = route->prefix;
+    hop.s_addr = route->hop.dst_ip;
+    inet_ntop(AF_INET, &prefix, prefix_text, sizeof(prefix_text));
+    inet_ntop(AF_INET, &hop, hop_text, sizeof(hop_text));
+    printf("%ld %s %s/%d via %s intf %u cost %u\n", now_ms, names[event], prefix_text,
+           __builtin_popcount(route->mask), hop_text, route->hop.interface, route->cost);
+}
+
+/** takes the interfaces of a record (count of them, at body) as the host's */
+static void set_interfaces(const uint8_t *body, unsigned count) {
+    lvns_interface_t *grown = (lvns_interface_t *) realloc(intfs, (count + 1) * sizeof(lvns_interface_t));
+    if (grown == NULL)
+        die("out of memory", NULL);
+    intfs = grown;
+    intf_count = count;
+    for (unsigned i = 0; i < count; i++) {
+        dr_capture_intf_t intf;
+        memcpy(&intf, body + i * sizeof(intf), sizeof(intf));
+        intfs[i].ip = intf.ip;
+        intfs[i].subnet_mask = intf.subnet_mask;
+        intfs[i].enabled = intf.enabled != 0;
+        intfs[i].cost = intf.cost;
+    }
+}
+
+static void apply_config(dr_router_t *router, const uint8_t *body, unsigned len) {
+    dr_capture_config_t config;
+    dr_route_limits_t limits;
+    dr_rate_limit_t rate_limit;
+
+    if (len < sizeof(config))
+        return;
+    memcpy(&config, body, sizeof(config));
+    dr_router_set_aggregation(router, config.aggregate);
+    dr_router_set_fib_compression(router, config.compress_fib);
+    limits.max_routes = config.max_routes;
+    limits.max_neighbour_routes = config.max_neighbour_routes;
+    limits.policy = (dr_overflow_policy_t) config.overflow_policy;
+    dr_router_set_route_limits(router, &limits);
+    rate_limit.rate = config.rate;
+    rate_limit.burst = config.burst;
+    rate_limit.policy = (dr_rate_policy_t) config.rate_policy;
+    dr_router_set_rate_limit(router, &rate_limit);
+}
+
+/* ******************************* replay ******************************* */
+
+/** replays the capture once and writes its JSON object */
+static void replay(const char *path) {
+    dr_capture_reader_t *reader = dr_capture_reader_open(path);
+    if (reader == NULL)
+        die("cannot read capture", path);
+
+    dr_capture_record_t record;
+    const uint8_t *body;
+    if (dr_capture_read(reader, &record, &body) != 1 || record.type != DR_CAPTURE_INTERFACES)
+        die("capture does not start with the interfaces", path);
+    set_interfaces(body, record.len / sizeof(dr_capture_intf_t));
+
+    long first_ms = record.time_ms;
+    now_ms = first_ms;
+    dr_clock_use_virtual(now_ms);
+    sent = 0;
+    sent_digest = 14695981039346656037ULL;
+    lookups_done = 0;
+
+    dr_host_t host;
+    host.interface_count = cb_interface_count;
+    host.get_interface = cb_get_interface;
+    host.send_payload = cb_send_payload;
+    host.user = NULL;
+    dr_router_t *router = dr_router_create(&host);
+    if (router == NULL)
+        die("cannot create router", NULL);
+    if (verbose)
+        dr_router_subscribe_routes(router, print_route, NULL);
+    dr_router_set_timing(router, dump_timing);
+
+    unsigned long records = 1, packets = 0, periodic = 0, changes = 0;
+    double started = wall_ms();
+    int status;
+    while ((status = dr_capture_read(reader, &record, &body)) == 1) {
+        records++;
+        if (record.time_ms > now_ms) {
+            dr_clock_advance(record.time_ms - now_ms);
+            now_ms = record.time_ms;
+        }
+        if (timed) {
+            double due = started + (now_ms - first_ms);
+            double wait = due - wall_ms();
+            if (wait > 0)
+                usleep((useconds_t) (wait * 1000));
+        }
+
+        switch (record.type) {
+            case DR_CAPTURE_CONFIG:
+                apply_config(router, body, record.len);
+                break;
+            case DR_CAPTURE_PACKET: {
+                uint32_t head[2];
+                if (record.len < sizeof(head))
+                    die("truncated packet record", path);
+                memcpy(head, body, sizeof(head));
+                dr_router_handle_packet(router, head[0], head[1], (char *) body + sizeof(head),
+                                        record.len - sizeof(head));
+                packets++;
+                break;
+            }
+            case DR_CAPTURE_PERIODIC:
+                dr_router_handle_periodic(router);
+                periodic++;
+                break;
+            case DR_CAPTURE_INTERFACE_CHANGED: {
+                uint32_t intf;
+                if (record.len < sizeof(intf))
+                    die("truncated interface record", path);
+                memcpy(&intf, body, sizeof(intf));
+                set_interfaces(body + sizeof(intf), (record.len - sizeof(intf)) / sizeof(dr_capture_intf_t));
+                dr_router_interface_changed(router, intf, (record.flags & DR_CAPTURE_STATE_CHANGED) != 0,
+                                            (record.flags & DR_CAPTURE_COST_CHANGED) != 0);
+                changes++;
+                break;
+            }
+            default:
+                break; /* written by a later version; it can do without */
+        }
+
+        if (lookups) {
+            for (unsigned i = 0; i < intf_count; i++)
+                dr_router_get_next_hop(router, intfs[i].ip);
+            lookups_done += intf_count;
+        }
+    }
+    if (status < 0)
+        fprintf(stderr, "dr_replay: %s is truncated; replayed what was complete\n", path);
+    double elapsed = wall_ms() - started;
+
+    dr_stats_t stats;
+    dr_router_get_stats(router, &stats);
+    printf("{\"capture\":\"%s\",\"records\":%lu,\"packets\":%lu,\"periodic\":%lu,\"changes\":%lu,"
+           "\"span_ms\":%ld,\"wall_ms\":%.3f,\"calls_per_s\":%.0f,\"sent\":%lu,\"sent_digest\":\"%016lx\","
+           "\"routes\":%u",
+           path, records, packets, periodic, changes, now_ms - first_ms, elapsed,
+           elapsed > 0 ? (packets + periodic + changes) / (elapsed / 1000.0) : 0.0,
+           (unsigned long) sent, (unsigned long) sent_digest, stats.routes);
+    if (lookups)
+        printf(",\"lookups\":%lu", (unsigned long) lookups_done);
+    printf("}\n");
+    if (dump_timing)
+        dr_router_dump_timing(router, stdout);
+    fflush(stdout);
+
+    dr_router_destroy(router);
+    dr_capture_reader_close(reader);
+}
+
+int main(int argc, char **argv) {
+    unsigned runs = 1;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "tvlTn:")) != -1) {
+        switch (opt) {
+            case 't': timed = 1; break;
+            case 'v': verbose = 1; break;
+            case 'l': lookups = 1; break;
+            case 'T': dump_timing = 1; break;
+            case 'n': runs = strtoul(optarg, NULL, 0); break;
+            default:
+                fprintf(stderr, "Usage: dr_replay [-t] [-v] [-l] [-T] [-n RUNS] CAPTURE\n");
+                return 1;
+        }
+    }
+    if (optind + 1 != argc) {
+        fprintf(stderr, "Usage: dr_replay [-t] [-v] [-l] [-T] [-n RUNS] CAPTURE\n");
+        return 1;
+    }
+
+    for (unsigned run = 0; run < runs; run++)
+        replay(argv[optind]);
+    free(intfs);
+    return 0;
+}
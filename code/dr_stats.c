@@ -0,0 +1,67 @@
+/* Filename: dr_stats.c */
+
+#include <fcntl.h>     /* O_* */
+#include <pthread.h>
+#include <sched.h>     /* sched_getcpu */
+#include <string.h>
+#include <sys/mman.h>  /* shm_open, mmap */
+#include <unistd.h>    /* ftruncate */
+
+#include "dr_stats.h"
+
+/* picks the shard of the CPU the calling thread is running on */
+static unsigned current_shard() {
+#ifdef _LINUX_
+    int cpu = sched_getcpu();
+    if (cpu >= 0)
+        return (unsigned) cpu & (DR_STATS_SHARDS - 1);
+#endif
+    /* otherwise spread the threads over the shards */
+    return (unsigned) ((uintptr_t) pthread_self() >> 6) & (DR_STATS_SHARDS - 1);
+}
+
+void dr_stats_count_lookup(dr_lookup_counters_t* counters, int miss) {
+    dr_lookup_shard_t* shard = &counters->shard[current_shard()];
+
+    /* threads may migrate between reading the CPU and counting, hence atomic */
+    __atomic_add_fetch(&shard->lookups, 1, __ATOMIC_RELAXED);
+    if (miss)
+        __atomic_add_fetch(&shard->misses, 1, __ATOMIC_RELAXED);
+}
+
+void dr_stats_sum_lookups(const dr_lookup_counters_t* counters, dr_stats_t* stats) {
+    stats->lookups = 0;
+    stats->lookup_misses = 0;
+    for (unsigned i = 0; i < DR_STATS_SHARDS; i++) {
+        stats->lookups += __atomic_load_n(&counters->shard[i].lookups, __ATOMIC_RELAXED);
+        stats->lookup_misses += __atomic_load_n(&counters->shard[i].misses, __ATOMIC_RELAXED);
+    }
+}
+
+dr_stats_page_t* dr_stats_page_open(const char* name) {
+    int fd = shm_open(name, O_CREAT | O_RDWR | O_TRUNC, 0644);
+    if (fd < 0)
+        return NULL;
+    if (ftruncate(fd, sizeof(dr_stats_page_t)) != 0) {
+        close(fd);
+        return NULL;
+    }
+
+    void* page = mmap(NULL, sizeof(dr_stats_page_t), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    return page == MAP_FAILED ? NULL : (dr_stats_page_t*) page;
+}
+
+void dr_stats_page_publish(dr_stats_page_t* page, const dr_stats_t* stats) {
+    uint32_t seq = page->seq;
+
+    __atomic_store_n(&page->seq, seq + 1, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+    memcpy(&page->stats, stats, sizeof(dr_stats_t));
+    __atomic_store_n(&page->seq, seq + 2, __ATOMIC_RELEASE);
+}
+
+void dr_stats_page_close(dr_stats_page_t* page) {
+    if (page != NULL)
+        munmap(page, sizeof(dr_stats_page_t));
+}
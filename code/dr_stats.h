@@ -0,0 +1,96 @@
+/*
+ * Filename: dr_stats.h
+ * Purpose:  Counters describing what a router has been doing, as returned by
+ *           dr_get_stats, and the shared-memory page they may be exported to.
+ */
+
+#ifndef _DR_STATS_H_
+#define _DR_STATS_H_
+
+#include <stdint.h>
+
+/** interfaces beyond this many are not broken out in dr_stats_t */
+#define DR_STATS_MAX_INTF 32
+
+/** lookups are counted per CPU in this many shards (a power of two) */
+#define DR_STATS_SHARDS 16
+
+/** counters for a single interface (all since the router was created) */
+typedef struct dr_intf_stats_t {
+    uint64_t adverts_rx;     /* advertisements received (well-formed only)  */
+    uint64_t adverts_unchanged; /* ... identical to the sender's previous one */
+    uint64_t adverts_deferred; /* ... beyond the rate limit, kept to be merged
+                                  later (see dr_set_rate_limit)               */
+    uint64_t adverts_dropped; /* ... beyond the rate limit and never merged   */
+    uint64_t adverts_tx;     /* advertisements sent                          */
+    uint64_t entries_rx;     /* route entries processed from advertisements  */
+    uint64_t bytes_rx;
+    uint64_t bytes_tx;
+    uint64_t triggered_tx;   /* sends caused by a change in the table        */
+    uint64_t periodic_tx;    /* sends caused by the advertisement interval   */
+    uint64_t routes_learned; /* routes added or moved onto this interface    */
+    uint64_t routes_rejected; /* advertised routes refused because of a limit
+                                 (see dr_set_route_limits), each time          */
+} dr_intf_stats_t;
+
+/** a snapshot of the counters of a router */
+typedef struct dr_stats_t {
+    uint64_t lookups;        /* calls to dr_get_next_hop                     */
+    uint64_t lookup_misses;  /* ... which returned 0xFFFFFFFF                */
+    uint32_t routes;         /* entries in the routing table                 */
+    uint32_t garbage;        /* ... of which are unreachable (garbage)       */
+    uint32_t paths;          /* routes as advertised by the neighbours       */
+    uint64_t routes_rejected; /* the sum of those of the interfaces          */
+    uint64_t routes_evicted; /* routes replaced by shorter prefixes          */
+    uint64_t routes_reclaimed; /* unreachable routes freed to make room      */
+    uint64_t pcap_dropped;   /* packets the pcap export dropped because its
+                                writer fell behind (see dr_export_pcap)      */
+    uint64_t memory_bytes;   /* memory held by the routing and forwarding tables */
+    uint64_t rib_bytes;      /* ... of which the routing table, the paths and
+                                neighbours behind it and the router's buffers */
+    uint64_t fib_bytes;      /* ... of which the forwarding table            */
+
+    uint32_t intf_count;     /* entries of intf which are in use             */
+    dr_intf_stats_t intf[DR_STATS_MAX_INTF];
+} dr_stats_t;
+
+/**
+ * The layout of an exported stats page.  The writer makes seq odd while it
+ * updates stats, so a reader copies stats and retries until it saw the same
+ * even seq before and after the copy.
+ */
+typedef struct dr_stats_page_t {
+    uint32_t seq;
+    dr_stats_t stats;
+} dr_stats_page_t;
+
+/** one shard of the lookup counters; each one fills a cache line */
+typedef struct dr_lookup_shard_t {
+    uint64_t lookups;
+    uint64_t misses;
+} __attribute__ ((aligned (64))) dr_lookup_shard_t;
+
+/** lookup counters, sharded by CPU so that concurrent lookups do not contend */
+typedef struct dr_lookup_counters_t {
+    dr_lookup_shard_t shard[DR_STATS_SHARDS];
+} dr_lookup_counters_t;
+
+/** Counts a lookup (and a miss, if miss is non-zero) on the current CPU's shard. */
+void dr_stats_count_lookup(dr_lookup_counters_t* counters, int miss);
+
+/** Sums the shards of the lookup counters into stats. */
+void dr_stats_sum_lookups(const dr_lookup_counters_t* counters, dr_stats_t* stats);
+
+/**
+ * Creates (or truncates) the POSIX shared memory object name and maps a
+ * dr_stats_page_t into it.  Returns NULL on failure.
+ */
+dr_stats_page_t* dr_stats_page_open(const char* name);
+
+/** Copies stats into the page, following the seq protocol described above. */
+void dr_stats_page_publish(dr_stats_page_t* page, const dr_stats_t* stats);
+
+/** Unmaps the page (the shared memory object itself stays until unlinked). */
+void dr_stats_page_close(dr_stats_page_t* page);
+
+#endif /* _DR_STATS_H_ */
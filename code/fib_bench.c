@@ -0,0 +1,425 @@
+/*
+ * Filename: fib_bench.c
+ * Purpose:  Lookup microbenchmark for the FIB backends behind dr_get_next_hop.
+ *
+ * For each table size a set of prefixes is generated whose length distribution
+ * resembles a real (BGP-sized) routing table, loaded into each backend, and
+ * looked up with three destination streams:
+ *
+ *   uniform     -- a random address inside a uniformly chosen prefix
+ *   zipf        -- as uniform, but prefixes are chosen Zipf(1)-skewed
+ *   sequential  -- consecutive addresses, walking the prefixes in order
+ *
+ * with one thread and with many.  Every backend is first checked against a
+ * reference scan.  One JSON object is written per line with the throughput
+ * (millions of lookups per second, all threads together) and the latency
+ * percentiles of single lookups.
+ *
+ * With -z the table is compressed (fib_compress) before it is loaded; fib_size
+ * then tells how many prefixes were left.  That only pays when few next hops
+ * are shared by many prefixes, which -h arranges.
+ *
+ * With -p the prefixes have only the listed lengths (equally often), as in
+ * the sparse tables of routers with few kinds of subnets.
+ *
+ * Usage: fib_bench [-n SIZES] [-b BACKENDS] [-t THREADS] [-l LOOKUPS] [-r SEED] [-h HOPS] [-p LENGTHS] [-z]
+ *   -n  comma separated table sizes      (default: 16,64,1000,10000,100000,1000000)
+ *   -b  comma separated backends         (default: all)
+ *   -t  number of threads for the multi-threaded runs (default: online CPUs)
+ *   -l  lookups per thread and run       (default: 2000000)
+ *   -h  distinct next hops               (default: 0, a random one per prefix)
+ *   -p  comma separated prefix lengths   (default: the typical mix above)
+ */
+
+#include <arpa/inet.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "dr_fib.h"
+
+/** no single run may take (much) longer than this, whatever the backend */
+#define BENCH_MAX_RUN_NS 2000000000LL
+
+/** how many lookups of each stream are checked against the reference */
+#define BENCH_VERIFY 20000
+
+/** how many single lookups are timed for the percentiles */
+#define BENCH_SAMPLES 200000
+
+/** number of destinations generated per stream (reused cyclically) */
+#define BENCH_STREAM 1048576
+
+/** share (in 1/1000) of each prefix length in a typical full table */
+static const struct {
+    unsigned len;
+    unsigned permille;
+} prefix_mix[] = {
+    {8, 1}, {12, 1}, {13, 2}, {14, 4}, {15, 6}, {16, 14}, {17, 9}, {18, 16},
+    {19, 30}, {20, 46}, {21, 52}, {22, 105}, {23, 95}, {24, 590}, {25, 4},
+    {26, 5}, {27, 4}, {28, 4}, {29, 4}, {30, 4}, {32, 4}
+};
+
+static const char *stream_names[] = {"uniform", "zipf", "sequential"};
+
+/** a lookup run on one thread */
+typedef struct bench_run_t {
+    const fib_t *fib;
+    const uint32_t *dsts;
+    unsigned long lookups;
+    unsigned long done;
+    unsigned long hits;
+    long long ns;
+} bench_run_t;
+
+static uint64_t rng_state;
+static unsigned hop_count;
+static unsigned lengths[33];
+static unsigned length_count;
+static int compress;
+
+static uint64_t rng_next() {
+    uint64_t z = (rng_state += 0x9E3779B97F4A7C15ULL);
+    z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+    z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+    return z ^ (z >> 31);
+}
+
+static long long now_ns() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+static void *xmalloc(size_t size) {
+    void *p = malloc(size ? size : 1);
+    if (p == NULL) {
+        fprintf(stderr, "fib_bench: out of memory\n");
+        exit(1);
+    }
+    return p;
+}
+
+static int cmp_prefix(const void *a, const void *b) {
+    const fib_entry_t *x = (const fib_entry_t *) a, *y = (const fib_entry_t *) b;
+    if (x->prefix != y->prefix)
+        return ntohl(x->prefix) < ntohl(y->prefix) ? -1 : 1;
+    return ntohl(x->mask) < ntohl(y->mask) ? -1 : ntohl(x->mask) > ntohl(y->mask);
+}
+
+/**
+ * Generates up to n distinct prefixes (sorted by address) with the typical
+ * length mix; n is updated to the number actually generated.
+ */
+static fib_entry_t *make_prefixes(unsigned *count) {
+    unsigned n = *count;
+    fib_entry_t *entries = (fib_entry_t *) xmalloc(n * sizeof(fib_entry_t));
+    unsigned total = 0;
+    for (unsigned k = 0; k < sizeof(prefix_mix) / sizeof(prefix_mix[0]); k++)
+        total += prefix_mix[k].permille;
+
+    for (unsigned i = 0; i < n; i++) {
+        unsigned len = 24;
+        if (length_count > 0)
+            len = lengths[rng_next() % length_count];
+        else {
+            unsigned pick = rng_next() % total;
+            for (unsigned k = 0; k < sizeof(prefix_mix) / sizeof(prefix_mix[0]); k++) {
+                if (pick < prefix_mix[k].permille) {
+                    len = prefix_mix[k].len;
+                    break;
+                }
+                pick -= prefix_mix[k].permille;
+            }
+        }
+        /* unicast space only: 1.0.0.0 - 223.255.255.255 */
+        uint32_t addr = 0x01000000u + (uint32_t) (rng_next() % 0xDF000000u);
+        uint32_t mask = len ? 0xFFFFFFFFu << (32 - len) : 0;
+        entries[i].prefix = htonl(addr & mask);
+        entries[i].mask = htonl(mask);
+        if (hop_count > 0) {
+            unsigned hop = rng_next() % hop_count;
+            entries[i].hop.interface = hop % 16;
+            entries[i].hop.dst_ip = htonl(0x0A000000u + hop);
+        } else {
+            entries[i].hop.interface = rng_next() % 16;
+            entries[i].hop.dst_ip = htonl(0x0A000000u + (rng_next() & 0xFFFF));
+        }
+    }
+    qsort(entries, n, sizeof(fib_entry_t), cmp_prefix);
+
+    unsigned distinct = 0;
+    for (unsigned i = 0; i < n; i++)
+        if (distinct == 0 || cmp_prefix(&entries[distinct - 1], &entries[i]) != 0)
+            entries[distinct++] = entries[i];
+    *count = distinct;
+    return entries;
+}
+
+/** returns a random address inside the prefix */
+static uint32_t address_in(const fib_entry_t *e) {
+    return e->prefix | (htonl((uint32_t) rng_next()) & ~e->mask);
+}
+
+/** fills dsts with BENCH_STREAM destinations of the given stream */
+static void make_stream(const char *stream, const fib_entry_t *entries, unsigned n, uint32_t *dsts) {
+    if (!strcmp(stream, "uniform")) {
+        for (unsigned i = 0; i < BENCH_STREAM; i++)
+            dsts[i] = address_in(&entries[rng_next() % n]);
+    } else if (!strcmp(stream, "zipf")) {
+        /* inverse transform sampling of Zipf(1) over a random ranking */
+        double *cdf = (double *) xmalloc(n * sizeof(double));
+        unsigned *rank = (unsigned *) xmalloc(n * sizeof(unsigned));
+        double sum = 0;
+        for (unsigned i = 0; i < n; i++) {
+            sum += 1.0 / (i + 1);
+            cdf[i] = sum;
+            rank[i] = i;
+        }
+        for (unsigned i = n - 1; i > 0; i--) {
+            unsigned j = rng_next() % (i + 1), t = rank[i];
+            rank[i] = rank[j];
+            rank[j] = t;
+        }
+        for (unsigned i = 0; i < BENCH_STREAM; i++) {
+            double u = (rng_next() >> 11) * (1.0 / 9007199254740992.0) * sum;
+            unsigned lo = 0, hi = n - 1;
+            while (lo < hi) {
+                unsigned mid = (lo + hi) / 2;
+                if (cdf[mid] < u)
+                    lo = mid + 1;
+                else
+                    hi = mid;
+            }
+            dsts[i] = address_in(&entries[rank[lo]]);
+        }
+        free(cdf);
+        free(rank);
+    } else {
+        unsigned k = 0;
+        uint32_t addr = ntohl(entries[0].prefix);
+        for (unsigned i = 0; i < BENCH_STREAM; i++) {
+            dsts[i] = htonl(addr++);
+            if ((htonl(addr) & entries[k].mask) != entries[k].prefix) {
+                k = (k + 1) % n;
+                addr = ntohl(entries[k].prefix);
+            }
+        }
+    }
+}
+
+/** the reference: longest matching prefix by a full scan */
+static next_hop_t reference_lookup(const fib_entry_t *entries, unsigned n, uint32_t ip) {
+    next_hop_t hop;
+    uint32_t best = 0;
+    int found = 0;
+
+    hop.interface = 0;
+    hop.dst_ip = 0xFFFFFFFF;
+    for (unsigned i = 0; i < n; i++)
+        if ((ip & entries[i].mask) == entries[i].prefix && (!found || ntohl(entries[i].mask) > best)) {
+            best = ntohl(entries[i].mask);
+            hop = entries[i].hop;
+            found = 1;
+        }
+    return hop;
+}
+
+static int verify(const fib_t *fib, const fib_entry_t *entries, unsigned n, const uint32_t *dsts) {
+    unsigned checks = n > 100000 ? BENCH_VERIFY / 10 : BENCH_VERIFY;
+    for (unsigned i = 0; i < checks; i++) {
+        /* every other destination is random, so misses get checked too */
+        uint32_t ip = (i & 1) ? (uint32_t) rng_next() : dsts[i];
+        next_hop_t want = reference_lookup(entries, n, ip);
+        next_hop_t got = fib_lookup(fib, ip);
+        if (want.dst_ip != got.dst_ip || (want.dst_ip != 0xFFFFFFFF && want.interface != got.interface)) {
+            char a[INET_ADDRSTRLEN];
+            inet_ntop(AF_INET, &ip, a, sizeof(a));
+            fprintf(stderr, "fib_bench: lookup of %s disagrees with the reference\n", a);
+            return 0;
+        }
+    }
+    return 1;
+}
+
+static void *run_lookups(void *arg) {
+    bench_run_t *run = (bench_run_t *) arg;
+    unsigned long hits = 0, i = 0;
+    long long start = now_ns(), deadline = start + BENCH_MAX_RUN_NS;
+
+    while (i < run->lookups) {
+        unsigned long stop = i + 4096 < run->lookups ? i + 4096 : run->lookups;
+        for (; i < stop; i++)
+            hits += fib_lookup(run->fib, run->dsts[i & (BENCH_STREAM - 1)]).dst_ip != 0xFFFFFFFF;
+        if (now_ns() > deadline)
+            break;
+    }
+    run->ns = now_ns() - start;
+    run->done = i;
+    run->hits = hits;
+    return NULL;
+}
+
+static int cmp_ll(const void *a, const void *b) {
+    long long x = *(const long long *) a, y = *(const long long *) b;
+    return x < y ? -1 : x > y;
+}
+
+/** times single lookups; the cost of reading the clock is subtracted */
+static void latency_percentiles(const fib_t *fib, const uint32_t *dsts, double pct[4]) {
+    static const double at[4] = {0.50, 0.90, 0.99, 0.999};
+    long long *samples = (long long *) xmalloc(BENCH_SAMPLES * sizeof(long long));
+    long long deadline = now_ns() + BENCH_MAX_RUN_NS, overhead = -1;
+    unsigned n = 0;
+    volatile uint32_t sink = 0;
+
+    for (unsigned i = 0; i < 1000; i++) {
+        long long t0 = now_ns(), t1 = now_ns();
+        if (overhead < 0 || t1 - t0 < overhead)
+            overhead = t1 - t0;
+    }
+    for (; n < BENCH_SAMPLES; n++) {
+        long long t0 = now_ns();
+        sink += fib_lookup(fib, dsts[(n * 7919) & (BENCH_STREAM - 1)]).interface;
+        long long t1 = now_ns();
+        samples[n] = t1 - t0 > overhead ? t1 - t0 - overhead : 0;
+        if ((n & 1023) == 0 && t1 > deadline)
+            break;
+    }
+    qsort(samples, n, sizeof(long long), cmp_ll);
+    for (int k = 0; k < 4; k++)
+        pct[k] = n ? (double) samples[(unsigned) (at[k] * (n - 1))] : 0;
+    free(samples);
+    (void) sink;
+}
+
+static void bench(const char *backend_name, fib_backend_t backend, const fib_entry_t *entries, unsigned n,
+                  unsigned threads, unsigned long lookups) {
+    fib_t *fib = fib_create(backend);
+    uint32_t *dsts = (uint32_t *) xmalloc(BENCH_STREAM * sizeof(uint32_t));
+    long long t0 = now_ns();
+    int loaded;
+    if (compress) {
+        fib_entry_t *compressed = (fib_entry_t *) xmalloc(n * sizeof(fib_entry_t));
+        memcpy(compressed, entries, n * sizeof(fib_entry_t));
+        int size = fib_compress(compressed, n);
+        if (size < 0) {
+            fprintf(stderr, "fib_bench: out of memory\n");
+            exit(1);
+        }
+        loaded = fib_load(fib, compressed, size);
+        free(compressed);
+    } else
+        loaded = fib_load(fib, entries, n);
+    if (loaded != 0) {
+        fprintf(stderr, "fib_bench: out of memory\n");
+        exit(1);
+    }
+    double load_ms = (now_ns() - t0) / 1e6;
+
+    for (unsigned s = 0; s < sizeof(stream_names) / sizeof(stream_names[0]); s++) {
+        make_stream(stream_names[s], entries, n, dsts);
+        if (!verify(fib, entries, n, dsts)) {
+            fprintf(stderr, "fib_bench: %s is wrong with %u prefixes\n", backend_name, n);
+            exit(1);
+        }
+
+        double pct[4];
+        latency_percentiles(fib, dsts, pct);
+
+        unsigned counts[2] = {1, threads};
+        for (unsigned c = 0; c < (threads > 1 ? 2u : 1u); c++) {
+            bench_run_t *runs = (bench_run_t *) xmalloc(counts[c] * sizeof(bench_run_t));
+            pthread_t *tids = (pthread_t *) xmalloc(counts[c] * sizeof(pthread_t));
+            for (unsigned t = 0; t < counts[c]; t++) {
+                runs[t].fib = fib;
+                runs[t].dsts = dsts;
+                runs[t].lookups = lookups;
+                pthread_create(&tids[t], NULL, run_lookups, &runs[t]);
+            }
+            unsigned long done = 0, hits = 0;
+            double mlps = 0;
+            for (unsigned t = 0; t < counts[c]; t++) {
+                pthread_join(tids[t], NULL);
+                done += runs[t].done;
+                hits += runs[t].hits;
+                mlps += runs[t].ns > 0 ? runs[t].done * 1e3 / runs[t].ns : 0;
+            }
+            printf("{\"backend\":\"%s\",\"prefixes\":%u,\"fib_size\":%u,\"load_ms\":%.3f,\"stream\":\"%s\","
+                   "\"threads\":%u,\"lookups\":%lu,\"hit_rate\":%.4f,\"mlps\":%.3f,"
+                   "\"p50_ns\":%.0f,\"p90_ns\":%.0f,\"p99_ns\":%.0f,\"p999_ns\":%.0f}\n",
+                   backend_name, n, fib_size(fib), load_ms, stream_names[s], counts[c], done,
+                   done ? (double) hits / done : 0, mlps, pct[0], pct[1], pct[2], pct[3]);
+            fflush(stdout);
+            free(runs);
+            free(tids);
+        }
+    }
+    free(dsts);
+    fib_destroy(fib);
+}
+
+static int parse_backend(const char *name, fib_backend_t *backend) {
+    static const fib_backend_t all[] = {FIB_LINEAR, FIB_TRIE, FIB_SMALL, FIB_AUTO, FIB_BLOOM};
+    for (unsigned i = 0; i < sizeof(all) / sizeof(all[0]); i++)
+        if (!strcmp(name, fib_backend_name(all[i]))) {
+            *backend = all[i];
+            return 1;
+        }
+    return 0;
+}
+
+int main(int argc, char **argv) {
+    char sizes[256] = "16,64,1000,10000,100000,1000000";
+    char backends[256] = "linear,trie,small,auto,bloom";
+    long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    unsigned threads = cpus > 1 ? (unsigned) cpus : 1;
+    unsigned long lookups = 2000000;
+    int opt;
+
+    rng_state = 1;
+    while ((opt = getopt(argc, argv, "n:b:t:l:r:h:p:z")) != -1) {
+        switch (opt) {
+            case 'n': snprintf(sizes, sizeof(sizes), "%s", optarg); break;
+            case 'b': snprintf(backends, sizeof(backends), "%s", optarg); break;
+            case 't': threads = atoi(optarg) > 0 ? atoi(optarg) : 1; break;
+            case 'l': lookups = strtoul(optarg, NULL, 0); break;
+            case 'r': rng_state = strtoull(optarg, NULL, 0); break;
+            case 'h': hop_count = strtoul(optarg, NULL, 0); break;
+            case 'p':
+                length_count = 0;
+                for (char *len = strtok(optarg, ","); len && length_count < 33; len = strtok(NULL, ","))
+                    if (strtoul(len, NULL, 0) <= 32)
+                        lengths[length_count++] = strtoul(len, NULL, 0);
+                break;
+            case 'z': compress = 1; break;
+            default:
+                fprintf(stderr, "Usage: fib_bench [-n SIZES] [-b BACKENDS] [-t THREADS] [-l LOOKUPS] [-r SEED] [-h HOPS] [-p LENGTHS] [-z]\n");
+                return 1;
+        }
+    }
+
+    for (char *size = strtok(sizes, ","); size; size = strtok(NULL, ",")) {
+        unsigned n = strtoul(size, NULL, 0);
+        if (n == 0)
+            continue;
+        fib_entry_t *entries = make_prefixes(&n);
+
+        char list[256], *save;
+        snprintf(list, sizeof(list), "%s", backends);
+        for (char *name = strtok_r(list, ",", &save); name; name = strtok_r(NULL, ",", &save)) {
+            fib_backend_t backend;
+            if (!parse_backend(name, &backend)) {
+                fprintf(stderr, "fib_bench: unknown backend %s\n", name);
+                return 1;
+            }
+            bench(name, backend, entries, n, threads, lookups);
+        }
+        free(entries);
+    }
+    return 0;
+}
@@ -0,0 +1,369 @@
+/*
+ * Filename: topogen.c
+ * Purpose:  Generates large synthetic topologies in the lvns .topo syntax.
+ *
+ * Every router is named drN.  Each link gets its own /30 out of 10.0.0.0/8 and
+ * each router gets a number of stub subnets (interfaces without a link), which
+ * are handed out consecutively from 100.0.0.0 so that the subnets of a router
+ * form contiguous blocks.  Link costs are written in the addr/len:cost notation
+ * (the same cost on both ends of a link).
+ *
+ * Usage: topogen [options] > file.topo
+ *   -t TYPE     grid, ring, random, waxman or scalefree     (default: grid)
+ *   -n N        number of routers                           (default: 100)
+ *   -s S        stub subnets per router                     (default: 1)
+ *   -p LEN      prefix length of the stub subnets           (default: 24)
+ *   -c MIN:MAX  link costs are drawn uniformly from MIN..MAX (default: 1:1)
+ *   -d DEG      average degree for random and waxman        (default: 4)
+ *   -m M        links per new router for scalefree          (default: 2)
+ *   -b BETA     waxman distance parameter                   (default: 0.15)
+ *   -r SEED     seed of the random number generator         (default: 1)
+ */
+
+#include <math.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+/** first address handed out for links (10.0.0.0) and stub subnets (100.0.0.0) */
+#define TOPOGEN_LINK_BASE 0x0A000000u
+#define TOPOGEN_STUB_BASE 0x64000000u
+
+/** a link between two routers */
+typedef struct topo_edge_t {
+    unsigned a;
+    unsigned b;
+} topo_edge_t;
+
+/** the generated graph */
+static topo_edge_t *edges;
+static unsigned edge_count;
+static unsigned edge_capacity;
+
+/* open-addressed set of the edges added so far, so no link is added twice */
+static uint64_t *edge_set;
+static unsigned edge_set_size;
+
+static uint64_t rng_state;
+
+static void die(const char *msg) {
+    fprintf(stderr, "topogen: %s\n", msg);
+    exit(1);
+}
+
+/** splitmix64, so that a seed gives the same topology everywhere */
+static uint64_t rng_next() {
+    uint64_t z = (rng_state += 0x9E3779B97F4A7C15ULL);
+    z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+    z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+    return z ^ (z >> 31);
+}
+
+/** returns a uniformly distributed integer in [0, n) */
+static unsigned rng_below(unsigned n) {
+    return (unsigned) (rng_next() % n);
+}
+
+/** returns a uniformly distributed double in [0, 1) */
+static double rng_unit() {
+    return (rng_next() >> 11) * (1.0 / 9007199254740992.0);
+}
+
+static uint64_t edge_key(unsigned a, unsigned b) {
+    return a < b ? ((uint64_t) a << 32 | b) + 1 : ((uint64_t) b << 32 | a) + 1;
+}
+
+static int has_edge(unsigned a, unsigned b) {
+    if (edge_set_size == 0)
+        return 0;
+
+    uint64_t key = edge_key(a, b);
+    unsigned i = (unsigned) ((key * 0x9E3779B97F4A7C15ULL) >> 32) & (edge_set_size - 1);
+    while (edge_set[i] != 0) {
+        if (edge_set[i] == key)
+            return 1;
+        i = (i + 1) & (edge_set_size - 1);
+    }
+    return 0;
+}
+
+/** adds the link a-b unless it is a self-loop or already present */
+static int add_edge(unsigned a, unsigned b) {
+    if (a == b || has_edge(a, b))
+        return 0;
+
+    if (2 * (edge_count + 1) > edge_set_size) {
+        uint64_t *old = edge_set;
+        unsigned old_size = edge_set_size;
+        edge_set_size = edge_set_size ? 2 * edge_set_size : 1024;
+        edge_set = (uint64_t *) calloc(edge_set_size, sizeof(uint64_t));
+        if (edge_set == NULL)
+            die("out of memory");
+        for (unsigned j = 0; j < old_size; j++) {
+            if (old[j] == 0)
+                continue;
+            unsigned i = (unsigned) ((old[j] * 0x9E3779B97F4A7C15ULL) >> 32) & (edge_set_size - 1);
+            while (edge_set[i] != 0)
+                i = (i + 1) & (edge_set_size - 1);
+            edge_set[i] = old[j];
+        }
+        free(old);
+    }
+    uint64_t key = edge_key(a, b);
+    unsigned i = (unsigned) ((key * 0x9E3779B97F4A7C15ULL) >> 32) & (edge_set_size - 1);
+    while (edge_set[i] != 0)
+        i = (i + 1) & (edge_set_size - 1);
+    edge_set[i] = key;
+
+    if (edge_count == edge_capacity) {
+        edge_capacity = edge_capacity ? 2 * edge_capacity : 1024;
+        edges = (topo_edge_t *) realloc(edges, edge_capacity * sizeof(topo_edge_t));
+        if (edges == NULL)
+            die("out of memory");
+    }
+    edges[edge_count].a = a;
+    edges[edge_count].b = b;
+    edge_count++;
+    return 1;
+}
+
+/* ****************************** graphs ****************************** */
+
+static void gen_grid(unsigned n) {
+    unsigned cols = (unsigned) ceil(sqrt((double) n));
+    for (unsigned i = 0; i < n; i++) {
+        if ((i + 1) % cols != 0 && i + 1 < n)
+            add_edge(i, i + 1);
+        if (i + cols < n)
+            add_edge(i, i + cols);
+    }
+}
+
+static void gen_ring(unsigned n) {
+    for (unsigned i = 0; i + 1 < n; i++)
+        add_edge(i, i + 1);
+    if (n > 2)
+        add_edge(n - 1, 0);
+}
+
+/** a random spanning tree plus random links up to the requested degree */
+static void gen_random(unsigned n, double degree) {
+    for (unsigned i = 1; i < n; i++)
+        add_edge(i, rng_below(i));
+
+    double wanted = n * degree / 2;
+    double possible = (double) n * (n - 1) / 2;
+    if (wanted > possible)
+        wanted = possible;
+    while (edge_count < wanted)
+        add_edge(rng_below(n), rng_below(n));
+}
+
+/**
+ * Waxman: routers are placed in the unit square and u-v are linked with
+ * probability alpha * exp(-d(u,v) / (beta * L)).  Alpha is chosen so that the
+ * average degree comes out as requested; a tree to the nearest earlier router
+ * keeps the graph connected.
+ */
+static void gen_waxman(unsigned n, double degree, double beta) {
+    double *x = (double *) malloc(n * sizeof(double));
+    double *y = (double *) malloc(n * sizeof(double));
+    if (x == NULL || y == NULL)
+        die("out of memory");
+    for (unsigned i = 0; i < n; i++) {
+        x[i] = rng_unit();
+        y[i] = rng_unit();
+    }
+
+    double scale = beta * sqrt(2.0);
+    for (unsigned i = 1; i < n; i++) {
+        unsigned nearest = 0;
+        double best = INFINITY;
+        for (unsigned j = 0; j < i; j++) {
+            double d = hypot(x[i] - x[j], y[i] - y[j]);
+            if (d < best) {
+                best = d;
+                nearest = j;
+            }
+        }
+        add_edge(i, nearest);
+    }
+
+    double sum = 0;
+    for (unsigned i = 0; i < n; i++)
+        for (unsigned j = i + 1; j < n; j++)
+            sum += exp(-hypot(x[i] - x[j], y[i] - y[j]) / scale);
+    double alpha = sum > 0 ? (n * degree / 2 - edge_count) / sum : 0;
+    if (alpha > 1)
+        alpha = 1;
+
+    if (alpha > 0)
+        for (unsigned i = 0; i < n; i++)
+            for (unsigned j = i + 1; j < n; j++)
+                if (rng_unit() < alpha * exp(-hypot(x[i] - x[j], y[i] - y[j]) / scale))
+                    add_edge(i, j);
+
+    free(x);
+    free(y);
+}
+
+/** Barabasi-Albert preferential attachment with m links per new router */
+static void gen_scalefree(unsigned n, unsigned m) {
+    /* every router appears once per link end, so a uniform pick is degree-biased */
+    unsigned *ends = (unsigned *) malloc(2 * (size_t) n * (m + 1) * sizeof(unsigned));
+    unsigned end_count = 0;
+    if (ends == NULL)
+        die("out of memory");
+
+    for (unsigned i = 1; i < n && i <= m; i++)
+        if (add_edge(i, i - 1)) {
+            ends[end_count++] = i;
+            ends[end_count++] = i - 1;
+        }
+
+    for (unsigned i = m + 1; i < n; i++) {
+        unsigned added = 0;
+        for (unsigned tries = 0; added < m && tries < 16 * m; tries++) {
+            unsigned j = ends[rng_below(end_count)];
+            if (add_edge(i, j)) {
+                ends[end_count++] = i;
+                ends[end_count++] = j;
+                added++;
+            }
+        }
+    }
+
+    free(ends);
+}
+
+/* ****************************** output ****************************** */
+
+static void print_ip(uint32_t ip) {
+    printf("%u.%u.%u.%u", ip >> 24, (ip >> 16) & 0xFF, (ip >> 8) & 0xFF, ip & 0xFF);
+}
+
+static void print_intf(uint32_t ip, unsigned len, unsigned cost) {
+    printf(" ");
+    print_ip(ip);
+    if (cost != 1)
+        printf("/%u:%u", len, cost);
+    else
+        printf("/%u", len);
+}
+
+static void write_topology(unsigned n, unsigned subnets, unsigned prefix_len,
+                           unsigned cost_min, unsigned cost_max) {
+    /* collect the links of each router */
+    unsigned *first = (unsigned *) calloc(n + 1, sizeof(unsigned));
+    unsigned *by_node = (unsigned *) malloc(2 * (size_t) edge_count * sizeof(unsigned) + 1);
+    unsigned *costs = (unsigned *) malloc((size_t) edge_count * sizeof(unsigned) + 1);
+    if (first == NULL || by_node == NULL || costs == NULL)
+        die("out of memory");
+    for (unsigned e = 0; e < edge_count; e++) {
+        first[edges[e].a + 1]++;
+        first[edges[e].b + 1]++;
+        costs[e] = cost_min + rng_below(cost_max - cost_min + 1);
+    }
+    for (unsigned i = 0; i < n; i++)
+        first[i + 1] += first[i];
+    unsigned *fill = (unsigned *) malloc((n + 1) * sizeof(unsigned));
+    memcpy(fill, first, (n + 1) * sizeof(unsigned));
+    for (unsigned e = 0; e < edge_count; e++) {
+        by_node[fill[edges[e].a]++] = e;
+        by_node[fill[edges[e].b]++] = e;
+    }
+
+    uint32_t stub = TOPOGEN_STUB_BASE;
+    uint32_t stub_size = 1u << (32 - prefix_len);
+    for (unsigned i = 0; i < n; i++) {
+        printf("node add dr%u dr", i + 1);
+        for (unsigned k = first[i]; k < first[i + 1]; k++) {
+            topo_edge_t *edge = &edges[by_node[k]];
+            uint32_t net = TOPOGEN_LINK_BASE + 4 * by_node[k];
+            print_intf(net + (edge->a == i ? 1 : 2), 30, costs[by_node[k]]);
+        }
+        for (unsigned k = 0; k < subnets; k++) {
+            print_intf(stub + (stub_size > 2 ? 1 : 0), prefix_len, 1);
+            stub += stub_size;
+        }
+        printf("\n");
+    }
+
+    printf("\n");
+    for (unsigned e = 0; e < edge_count; e++) {
+        uint32_t net = TOPOGEN_LINK_BASE + 4 * e;
+        printf("link add ");
+        print_ip(net + 1);
+        printf(" ");
+        print_ip(net + 2);
+        printf("\n");
+    }
+
+    free(first);
+    free(fill);
+    free(by_node);
+    free(costs);
+}
+
+static void usage() {
+    fprintf(stderr, "Usage: topogen [-t grid|ring|random|waxman|scalefree] [-n ROUTERS] [-s SUBNETS]\n"
+                    "               [-p PREFIXLEN] [-c MIN:MAX] [-d DEGREE] [-m LINKS] [-b BETA] [-r SEED]\n");
+    exit(1);
+}
+
+int main(int argc, char **argv) {
+    const char *type = "grid";
+    unsigned n = 100, subnets = 1, prefix_len = 24, cost_min = 1, cost_max = 1, m = 2;
+    double degree = 4, beta = 0.15;
+    unsigned long seed = 1;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "t:n:s:p:c:d:m:b:r:")) != -1) {
+        switch (opt) {
+            case 't': type = optarg; break;
+            case 'n': n = atoi(optarg); break;
+            case 's': subnets = atoi(optarg); break;
+            case 'p': prefix_len = atoi(optarg); break;
+            case 'c':
+                if (sscanf(optarg, "%u:%u", &cost_min, &cost_max) != 2)
+                    usage();
+                break;
+            case 'd': degree = atof(optarg); break;
+            case 'm': m = atoi(optarg); break;
+            case 'b': beta = atof(optarg); break;
+            case 'r': seed = strtoul(optarg, NULL, 0); break;
+            default: usage();
+        }
+    }
+    if (n < 1 || prefix_len < 8 || prefix_len > 30 || cost_min < 1 || cost_max < cost_min ||
+        cost_max > 15 || m < 1 || beta <= 0)
+        usage();
+    if ((uint64_t) n * subnets << (32 - prefix_len) > 0xDFFFFFFFu - TOPOGEN_STUB_BASE)
+        die("too many stub subnets for the 100.0.0.0 - 223.255.255.255 range");
+    rng_state = seed;
+
+    if (!strcmp(type, "grid"))
+        gen_grid(n);
+    else if (!strcmp(type, "ring"))
+        gen_ring(n);
+    else if (!strcmp(type, "random"))
+        gen_random(n, degree);
+    else if (!strcmp(type, "waxman"))
+        gen_waxman(n, degree, beta);
+    else if (!strcmp(type, "scalefree"))
+        gen_scalefree(n, m);
+    else
+        usage();
+    if (edge_count > (1u << 22))
+        die("too many links for 10.0.0.0/8");
+
+    printf("# generated by topogen -t %s -n %u -s %u -p %u -c %u:%u -d %g -m %u -b %g -r %lu\n\n",
+           type, n, subnets, prefix_len, cost_min, cost_max, degree, m, beta, seed);
+    write_topology(n, subnets, prefix_len, cost_min, cost_max);
+
+    free(edges);
+    free(edge_set);
+    return 0;
+}